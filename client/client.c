@@ -1,45 +1,446 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
 #include <json-c/json.h>
 #include "message.h"
+#include "chunk.h"
+#include "compress.h"
+#include "congestion.h"
+#include "crc32c.h"
+#include "sha256.h"
 #include "states.h"
+#include "ring.h"
+#include "log.h"
+#include "xxh64.h"
 
-// Define maximum message and file segment sizes
+// Define maximum message size
 #define MAX_MESSAGE_SIZE 1024
-#define FILE_SEGMENT_SIZE 512
 
-// Function declarations for sending file transfer requests and segments
-void send_file_transfer_request(int sockfd, struct sockaddr_in *servaddr, socklen_t len, const char *filename);
-void send_file_segments(int sockfd, struct sockaddr_in *servaddr, socklen_t len, FILE *file, uint32_t file_id);
+// IPv4 and UDP header bytes in front of every datagram payload
+#define IPV4_UDP_HEADER_SIZE 28
+
+// Path MTU probing: time to wait for each probe's acknowledgment, sends per probe size before it
+// is considered too large, and the precision at which the search stops
+#define PMTU_PROBE_TIMEOUT_MS 100
+#define PMTU_PROBE_ATTEMPTS 2
+#define PMTU_PROBE_GRANULARITY 64
+
+// Maximum number of segments coalesced into one UDP GSO send
+#define MAX_GSO_SEGMENTS 64
+
+// Maximum number of unacknowledged segments in flight
+#define MAX_WINDOW_SEGMENTS 65536
+
+// File bytes advised for readahead beyond the far edge of the window
+#define READAHEAD_BYTES (4 * 1024 * 1024)
+
+// Time without progress after which unacknowledged manifest parts are sent again (file segments
+// use a timeout estimated from their RTT), and how many retransmission timeouts in a row are
+// attempted before the transfer is abandoned
+#define RETRANSMIT_TIMEOUT_MS 200
+#define MAX_RETRANSMISSIONS 10
+
+// File transfer request: time to wait for the response, doubled for each resend, and how often it
+// is sent before the transfer is abandoned
+#define REQUEST_TIMEOUT_MS 200
+#define REQUEST_ATTEMPTS 5
+
+// Fast retransmit: a segment is taken for lost once this many segments beyond it are acknowledged,
+// and the oldest one also once this many acknowledgments in a row bring nothing new
+#define DUP_THRESHOLD 3
+
+// Chunk manifest parts sent ahead of the oldest unacknowledged one
+#define MANIFEST_WINDOW 16
+
+// Session hello: time to wait for the server's reply and how often it is sent before the client
+// gives up and sends everything uncompressed
+#define HELLO_TIMEOUT_MS 100
+#define HELLO_ATTEMPTS 3
+
+// A payload is only sent compressed when that saves at least 1/COMPRESSION_MIN_SAVING of it
+#define COMPRESSION_MIN_SAVING 16
+
+// Most sockets one upload is striped across, and the least each stripe must carry
+#define MAX_STRIPES 16
+#define MIN_STRIPE_BYTES (4 * 1024 * 1024)
+
+// Most queued files uploaded at the same time, and the replies each upload's inbox can hold
+#define MAX_UPLOADS 16
+#define INBOX_SLOTS 256
+
+// Client settings loaded from config/client_config.json
+typedef struct {
+    char server_ip[16]; // Dotted IPv4 address of the server
+    int port; // UDP port of the server
+    int gso_segments; // Segments sent per UDP_SEGMENT burst (1 disables GSO)
+    int window_segments; // Segments sent ahead of the oldest unacknowledged one
+    int segment_size; // Segment payload to request (0 discovers it from the path MTU)
+    int dedup; // Offer a chunk manifest so the server can skip content it already stores
+    int compression; // Offer the server payload compression at startup
+    int stripes; // Sockets a large upload is striped across, each sent from its own thread
+    int uploads; // Queued files uploaded at the same time, all over the client's socket
+    CongestionAlgorithm congestion_control; // Limits the segments in flight and paces their sending
+    LogLevel log_level; // Most verbose level written to the log
+    int log_sample; // Record one in log_sample debug messages per call site
+} ClientConfig;
+
+ClientConfig client_config = {
+    .server_ip = "127.0.0.1",
+    .port = 4433,
+    .gso_segments = 1,
+    .window_segments = 64,
+    .segment_size = 0,
+    .dedup = 1,
+    .compression = 1,
+    .stripes = 1,
+    .uploads = 4,
+    .congestion_control = CC_CUBIC,
+    .log_level = LOG_LEVEL_INFO,
+    .log_sample = 1,
+};
+
+// Codec confirmed by the server at startup, CP_CODEC_NONE when payloads are sent as is
+static uint8_t session_codec = CP_CODEC_NONE;
+
+// Datagram from the server, as passed from the receive thread to the thread it is meant for
+typedef struct {
+    uint16_t length;
+    char data[MAX_MESSAGE_SIZE + sizeof(CP_Header)]; // Fits every reply; longer datagrams are cut short
+} Reply;
+
+// Replies routed to one thread: a ring filled by the receive thread only, and an eventfd it
+// signals after each reply so the owner can sleep in poll until one arrives
+typedef struct {
+    SpscRing ring;
+    int wake_fd;
+    uint32_t file_id; // Transfer whose acknowledgments are routed here
+    int bound; // file_id is set; changed under the manager's lock
+} Inbox;
+
+// File waiting in the upload queue
+typedef struct UploadJob {
+    char filename[MAX_FILENAME_LENGTH];
+    uint8_t flags; // CP_TRANSFER_RESUME to continue an interrupted upload
+    struct UploadJob *next;
+} UploadJob;
+
+// Background transfer manager: upload threads take queued files in turn and all send over the
+// client's socket. Files of the same name are uploaded one after the other, since the server takes
+// a request for a name it has not yet received anything for as a repeat of the earlier request.
+// One receive thread reads that socket and routes each reply by type and file ID: acknowledgments
+// to the upload they belong to, text echoes to the prompt, and a transfer response that echoes the
+// outstanding request's ID to the upload that sent it, binding the upload to the new file ID.
+typedef struct {
+    int sockfd;
+    struct sockaddr_in servaddr;
+    socklen_t len;
+    pthread_mutex_t lock; // Protects the queue, requester and the inbox bindings
+    pthread_cond_t queued;
+    UploadJob *head;
+    UploadJob *tail;
+    int closing; // No more files are queued; upload threads exit once the queue is empty
+    pthread_mutex_t request_lock; // Held while a file transfer request is outstanding
+    Inbox *requester; // Inbox the next file transfer response goes to
+    uint32_t requester_id; // Request ID that response must echo
+    Inbox text; // Echoes of text messages, for the prompt
+    Inbox uploads[MAX_UPLOADS];
+    UploadJob *active[MAX_UPLOADS]; // File each upload thread is sending, NULL when idle
+    pthread_t upload_threads[MAX_UPLOADS];
+    int upload_count;
+    pthread_t receive_thread;
+    int stop_fd; // eventfd that ends the receive thread
+} TransferManager;
+
+static TransferManager transfer_manager;
+
+// Last file transfer request ID handed out, shared by the upload and stripe threads
+static uint32_t last_request_id;
+
+// Ticket lock that hands the sending side of the client's shared socket to concurrent uploads in
+// turn, one burst each in the order they asked for it, so no upload starves the others. Stripes
+// sent from sockets of their own do not take turns.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t turn;
+    uint64_t next_ticket;
+    uint64_t serving;
+} SendTurns;
+
+static SendTurns send_turns = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .turn = PTHREAD_COND_INITIALIZER,
+};
+
+// Function declarations for the transfer manager, sending requests, file transfer requests and segments
+static int transfer_manager_start(int sockfd, struct sockaddr_in *servaddr, socklen_t len);
+static void transfer_manager_stop(void);
+static void queue_upload(const char *filename, uint8_t flags);
+void send_file_transfer_request(int sockfd, struct sockaddr_in *servaddr, socklen_t len, Inbox *inbox, const char *filename, uint8_t flags);
+int send_file_segments(int sockfd, struct sockaddr_in *servaddr, socklen_t len, Inbox *inbox, FILE *file, uint64_t offset, uint64_t file_size, uint32_t file_id, uint16_t segment_size, uint32_t first_segment, int dedup);
+static int send_request(int sockfd, struct sockaddr_in *servaddr, socklen_t len, Inbox *inbox, const void *request, size_t size, char *reply, size_t capacity, int answer_type, uint32_t request_id);
+
+// Function to read an integer setting, keeping the default when the key is absent
+static int config_get_int(struct json_object *parsed_json, const char *key, int default_value) {
+    struct json_object *value;
+    if (parsed_json == NULL || !json_object_object_get_ex(parsed_json, key, &value)) {
+        return default_value;
+    }
+    return json_object_get_int(value);
+}
 
 // Function to read client configuration from a JSON file
-void read_client_config(const char *filename, char *server_ip, int *port) {
+void read_client_config(const char *filename, ClientConfig *config) {
     FILE *file = fopen(filename, "r");
     if (file == NULL) {
-        printf("Failed to open client configuration file: %s\n", strerror(errno));
+        LOG_ERROR("Failed to open client configuration file: %s", strerror(errno));
         handle_transition(ERROR);
         exit(EXIT_FAILURE);
     }
 
     struct json_object *parsed_json;
     struct json_object *json_server_ip;
-    struct json_object *json_port;
 
-    char buffer[256];
-    fread(buffer, sizeof(buffer), 1, file);
+    char buffer[1024];
+    size_t n = fread(buffer, 1, sizeof(buffer) - 1, file);
+    buffer[n] = '\0';
     fclose(file);
 
     parsed_json = json_tokener_parse(buffer);
-    json_object_object_get_ex(parsed_json, "server_ip", &json_server_ip);
-    json_object_object_get_ex(parsed_json, "server_port", &json_port);
-    strcpy(server_ip, json_object_get_string(json_server_ip));
-    *port = json_object_get_int(json_port);
+    if (parsed_json != NULL && json_object_object_get_ex(parsed_json, "server_ip", &json_server_ip)) {
+        snprintf(config->server_ip, sizeof(config->server_ip), "%s", json_object_get_string(json_server_ip));
+    }
+    config->port = config_get_int(parsed_json, "server_port", config->port);
+    config->gso_segments = config_get_int(parsed_json, "gso_segments", config->gso_segments);
+    config->window_segments = config_get_int(parsed_json, "window_segments", config->window_segments);
+    config->segment_size = config_get_int(parsed_json, "segment_size", config->segment_size);
+    config->dedup = config_get_int(parsed_json, "dedup", config->dedup);
+    config->compression = config_get_int(parsed_json, "compression", config->compression);
+    config->stripes = config_get_int(parsed_json, "stripes", config->stripes);
+    config->uploads = config_get_int(parsed_json, "uploads", config->uploads);
+    config->log_sample = config_get_int(parsed_json, "log_sample", config->log_sample);
+    struct json_object *json_log_level;
+    if (parsed_json != NULL && json_object_object_get_ex(parsed_json, "log_level", &json_log_level)) {
+        config->log_level = log_level_from_string(json_object_get_string(json_log_level), config->log_level);
+    }
+    struct json_object *json_congestion_control;
+    if (parsed_json != NULL && json_object_object_get_ex(parsed_json, "congestion_control", &json_congestion_control)) {
+        config->congestion_control = cc_algorithm_from_string(json_object_get_string(json_congestion_control), config->congestion_control);
+    }
+    json_object_put(parsed_json);
+
+    if (config->gso_segments < 1) {
+        config->gso_segments = 1;
+    } else if (config->gso_segments > MAX_GSO_SEGMENTS) {
+        config->gso_segments = MAX_GSO_SEGMENTS;
+    }
+    if (config->window_segments < 1) {
+        config->window_segments = 1;
+    } else if (config->window_segments > MAX_WINDOW_SEGMENTS) {
+        config->window_segments = MAX_WINDOW_SEGMENTS;
+    }
+    if (config->segment_size < 0) {
+        config->segment_size = 0;
+    } else if (config->segment_size > CP_MAX_SEGMENT_SIZE) {
+        config->segment_size = CP_MAX_SEGMENT_SIZE;
+    }
+    if (config->stripes < 1) {
+        config->stripes = 1;
+    } else if (config->stripes > MAX_STRIPES) {
+        config->stripes = MAX_STRIPES;
+    }
+    if (config->uploads < 1) {
+        config->uploads = 1;
+    } else if (config->uploads > MAX_UPLOADS) {
+        config->uploads = MAX_UPLOADS;
+    }
+    if (config->log_sample < 1) {
+        config->log_sample = 1;
+    }
+}
+
+// Function to read the monotonic clock in milliseconds
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Function to read the monotonic clock in microseconds, for RTT samples and pacing
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Function to find the largest segment payload whose encoding fits in datagram_size bytes
+static uint16_t segment_size_for_datagram(size_t datagram_size) {
+    size_t size = datagram_size - file_segment_wire_size(0);
+    return size > CP_MAX_SEGMENT_SIZE ? CP_MAX_SEGMENT_SIZE : size;
+}
+
+// Function to read the MTU of the local route to the server through a connected scratch socket
+static int route_mtu(struct sockaddr_in *servaddr, socklen_t len) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int mtu;
+    socklen_t optlen = sizeof(mtu);
+    if (connect(fd, (const struct sockaddr *)servaddr, len) < 0 || getsockopt(fd, IPPROTO_IP, IP_MTU, &mtu, &optlen) < 0) {
+        mtu = -1;
+    }
+    close(fd);
+    return mtu;
+}
+
+// Function to send a probe of probe_size bytes and wait for the server to acknowledge it.
+// Returns the bytes the server received, or 0 if the probe does not fit the path or was lost
+// every time.
+static size_t send_path_probe(int sockfd, struct sockaddr_in *servaddr, socklen_t len, char *buffer, uint16_t probe_size) {
+    encode_path_probe(buffer, probe_size);
+    for (int attempt = 0; attempt < PMTU_PROBE_ATTEMPTS; attempt++) {
+        // EMSGSIZE: larger than the local interface allows
+        if (sendto(sockfd, buffer, probe_size, 0, (const struct sockaddr *)servaddr, len) < 0) {
+            return 0;
+        }
+
+        uint64_t deadline = now_ms() + PMTU_PROBE_TIMEOUT_MS;
+        uint64_t now;
+        while ((now = now_ms()) < deadline) {
+            struct pollfd pfd = {
+                .fd = sockfd,
+                .events = POLLIN,
+            };
+            if (poll(&pfd, 1, (int)(deadline - now)) <= 0) {
+                break;
+            }
+            // Late acknowledgments of smaller probes are skipped
+            char reply[sizeof(CP_PathProbeAck)];
+            CP_PathProbeView ack;
+            int n = recvfrom(sockfd, reply, sizeof(reply), MSG_DONTWAIT, (struct sockaddr *)servaddr, &len);
+            if (n > 0 && view_path_probe_ack(reply, n, &ack) == 0 && ack.probe_size == probe_size) {
+                return ack.received_size;
+            }
+        }
+    }
+    return 0;
+}
+
+// Function to find the largest datagram that reaches the server in one piece and derive the
+// segment size to request from it. Probes carry the don't-fragment bit and are searched between
+// a default-size segment and the route MTU, trying the route MTU first since it usually fits.
+// A probe the server truncated moves the search straight to the size it took.
+static uint16_t discover_segment_size(int sockfd, struct sockaddr_in *servaddr, socklen_t len) {
+    int mtu = route_mtu(servaddr, len);
+    if (mtu < 0) {
+        perror("Failed to read route MTU");
+        return FILE_SEGMENT_SIZE;
+    }
+    size_t low = file_segment_wire_size(FILE_SEGMENT_SIZE); // Largest size known to fit
+    size_t high = mtu - IPV4_UDP_HEADER_SIZE;
+    if (high > CP_MAX_DATAGRAM_SIZE) {
+        high = CP_MAX_DATAGRAM_SIZE;
+    }
+    if (high <= low) {
+        return FILE_SEGMENT_SIZE;
+    }
+    char *buffer = malloc(high);
+    if (buffer == NULL) {
+        perror("Failed to allocate path MTU probe");
+        return FILE_SEGMENT_SIZE;
+    }
+
+    // Probe beyond the kernel's cached path MTU, then restore the socket's own setting
+    int saved_mode;
+    socklen_t optlen = sizeof(saved_mode);
+    int probe_mode = IP_PMTUDISC_PROBE;
+    int restore = getsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &saved_mode, &optlen) == 0;
+    if (setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &probe_mode, sizeof(probe_mode)) < 0) {
+        perror("Failed to set IP_MTU_DISCOVER");
+    }
+
+    size_t fits = 0;
+    size_t probe = high;
+    while (1) {
+        size_t received = send_path_probe(sockfd, servaddr, len, buffer, probe);
+        if (received == probe) {
+            low = fits = probe;
+        } else if (received > low) {
+            high = probe = received;
+            continue;
+        } else {
+            high = probe;
+        }
+        if (high - low <= PMTU_PROBE_GRANULARITY) {
+            break;
+        }
+        probe = low + (high - low) / 2;
+    }
+
+    if (restore) {
+        setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &saved_mode, sizeof(saved_mode));
+    }
+    free(buffer);
+
+    if (fits == 0) {
+        LOG_WARN("Path MTU probes unanswered, using %d byte segments", FILE_SEGMENT_SIZE);
+        return FILE_SEGMENT_SIZE;
+    }
+    LOG_INFO("Path MTU probe: %zu byte datagrams reach the server (route MTU %d)", fits, mtu);
+    return segment_size_for_datagram(fits);
+}
+
+// Function to offer the server the codecs this client implements and pick one it confirms.
+// A server that predates compression never answers, and payloads are then sent as is.
+static uint8_t negotiate_codec(int sockfd, struct sockaddr_in *servaddr, socklen_t len) {
+    CP_SessionHello hello;
+    encode_session_hello(&hello, codec_supported());
+    for (int attempt = 0; attempt < HELLO_ATTEMPTS; attempt++) {
+        if (sendto(sockfd, &hello, sizeof(hello), 0, (const struct sockaddr *)servaddr, len) < 0) {
+            perror("Failed to send session hello");
+            return CP_CODEC_NONE;
+        }
+
+        uint64_t deadline = now_ms() + HELLO_TIMEOUT_MS;
+        uint64_t now;
+        while ((now = now_ms()) < deadline) {
+            struct pollfd pfd = {
+                .fd = sockfd,
+                .events = POLLIN,
+            };
+            if (poll(&pfd, 1, (int)(deadline - now)) <= 0) {
+                break;
+            }
+            // Late acknowledgments of path probes are skipped
+            char reply[sizeof(CP_SessionHello)];
+            uint8_t codecs;
+            int n = recvfrom(sockfd, reply, sizeof(reply), MSG_DONTWAIT, (struct sockaddr *)servaddr, &len);
+            if (n > 0 && view_session_hello(reply, n, &codecs) == 0) {
+                codecs &= codec_supported();
+                for (uint8_t codec = CP_CODEC_NONE + 1; codec <= CP_HEADER_CODEC_MASK; codec++) {
+                    if (codecs & (1 << codec)) {
+                        return codec;
+                    }
+                }
+                return CP_CODEC_NONE;
+            }
+        }
+    }
+    LOG_WARN("Session hello unanswered, sending payloads uncompressed");
+    return CP_CODEC_NONE;
 }
 
 int main() {
@@ -47,22 +448,22 @@ int main() {
     struct sockaddr_in servaddr;
     socklen_t len;
     char buffer[MAX_MESSAGE_SIZE + sizeof(CP_Header)];
+    char packed[MAX_MESSAGE_SIZE];
     CP_TextMessage text_message;
     CP_FileTransferRequest file_request;
-    CP_FileSegment file_segment;
     CP_FileSegmentAck file_ack;
     CP_FileTransferComplete file_complete;
     char input[MAX_MESSAGE_SIZE];
-    char decoded_message[MAX_MESSAGE_SIZE];
-    char server_ip[16];
-    int port;
 
     // Initialize state to DISCONNECTED and transition to CONNECTING
     current_state = DISCONNECTED;
     handle_transition(CONNECTING);
 
     // Read client configuration to get server IP and port
-    read_client_config("config/client_config.json", server_ip, &port);
+    read_client_config("config/client_config.json", &client_config);
+    if (log_init(client_config.log_level, client_config.log_sample) < 0) {
+        perror("Failed to start log flusher");
+    }
 
     // Create a socket for communication
     if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
@@ -74,10 +475,10 @@ int main() {
     // Initialize server address structure
     memset(&servaddr, 0, sizeof(servaddr));
     servaddr.sin_family = AF_INET;
-    servaddr.sin_port = htons(port);
+    servaddr.sin_port = htons(client_config.port);
 
     // Convert server IP address from text to binary form
-    if (inet_pton(AF_INET, server_ip, &servaddr.sin_addr) <= 0) {
+    if (inet_pton(AF_INET, client_config.server_ip, &servaddr.sin_addr) <= 0) {
         perror("Invalid address/ Address not supported");
         handle_transition(ERROR);
         close(sockfd);
@@ -88,47 +489,594 @@ int main() {
     handle_transition(CONNECTED);
     len = sizeof(servaddr);
 
+    // Size file segments to the path unless a size is configured
+    if (client_config.segment_size == 0) {
+        client_config.segment_size = discover_segment_size(sockfd, &servaddr, len);
+    }
+    if (client_config.compression) {
+        session_codec = negotiate_codec(sockfd, &servaddr, len);
+        LOG_INFO("Payload compression: %s", codec_name(session_codec));
+    }
+
+    // From here on the socket is read by the transfer manager's receive thread
+    if (transfer_manager_start(sockfd, &servaddr, len) < 0) {
+        handle_transition(ERROR);
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+
     while (1) {
-        // Prompt user for input (message or filename)
+        // Write out pending log lines, then prompt user for input (message or filename)
+        log_flush();
         printf("Enter message or filename: ");
-        fgets(input, sizeof(input), stdin);
+        if (fgets(input, sizeof(input), stdin) == NULL) {
+            break; // End of input: finish the queued uploads, then disconnect
+        }
         input[strcspn(input, "\n")] = '\0'; // Remove newline character
 
         if (strncmp(input, "file:", 5) == 0) {
-            // Handle file transfer request
-            const char *filename = input + 5;
-            send_file_transfer_request(sockfd, &servaddr, len, filename);
+            // Queue the file; it is uploaded in the background while the prompt stays usable
+            queue_upload(input + 5, 0);
+        } else if (strncmp(input, "resume:", 7) == 0) {
+            // Continue an interrupted upload from the segments the server is missing
+            queue_upload(input + 7, CP_TRANSFER_RESUME);
         } else {
-            // Handle text message
-            encode_text_message(&text_message, input);
-            memcpy(buffer, &text_message, sizeof(text_message));
-
-            sendto(sockfd, buffer, sizeof(buffer), MSG_CONFIRM, (const struct sockaddr *)&servaddr, len);
-
-            printf("Sending message: %s\n", input);
-            printf("Bytes sent: %ld\n", sizeof(buffer));
+            // Handle text message, compressed when the server decodes it and it shrinks enough
+            size_t input_length = strlen(input);
+            size_t compressed = 0;
+            if (session_codec != CP_CODEC_NONE && codec_worthwhile(input, input_length)) {
+                compressed = codec_compress(session_codec, input, input_length, packed, input_length - input_length / COMPRESSION_MIN_SAVING);
+            }
+            size_t size = sizeof(text_message);
+            if (compressed > 0) {
+                size = encode_compressed_text_message(&text_message, packed, compressed, session_codec);
+            } else {
+                encode_text_message(&text_message, input);
+            }
+            LOG_DEBUG("Sending message: %s", input);
+            LOG_DEBUG("Bytes sent: %zu", size);
 
-            // Receive server response
-            int n = recvfrom(sockfd, buffer, sizeof(buffer), MSG_WAITALL, (struct sockaddr *)&servaddr, &len);
-            if (n > 0) {
-                memcpy(&text_message, buffer, sizeof(text_message));
-                decode_text_message(&text_message, decoded_message);
-                printf("Server echo: %s\n", decoded_message);
+            // Receive server response, which comes back compressed if the message was
+            int n = send_request(sockfd, &servaddr, len, &transfer_manager.text, &text_message, size, buffer, sizeof(buffer), CP_TEXT_MESSAGE, 0);
+            CP_TextMessageView echo;
+            int echo_length = -1;
+            if (n > 0 && view_text_message(buffer, n, &echo) == 0) {
+                echo_length = echo.length;
+                if (echo.codec != CP_CODEC_NONE) {
+                    echo_length = codec_decompress(echo.codec, echo.content, echo.length, packed, sizeof(packed));
+                    echo.content = packed;
+                }
+            }
+            if (echo_length >= 0) {
+                printf("Server echo: %.*s\n", echo_length, echo.content);
             } else {
                 handle_transition(ERROR);
             }
         }
     }
 
-    // Transition to DISCONNECTING state and close the socket
+    // Transition to DISCONNECTING state once the queued uploads are done, and close the socket
     handle_transition(DISCONNECTING);
+    transfer_manager_stop();
     close(sockfd);
     handle_transition(DISCONNECTED);
     return 0;
 }
 
+// Function to set up an inbox the receive thread can route replies to
+static int inbox_init(Inbox *inbox) {
+    inbox->bound = 0;
+    if (ring_init(&inbox->ring, INBOX_SLOTS, sizeof(Reply)) < 0) {
+        return -1;
+    }
+    inbox->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inbox->wake_fd < 0) {
+        ring_free(&inbox->ring);
+        return -1;
+    }
+    return 0;
+}
+
+static void inbox_free(Inbox *inbox) {
+    close(inbox->wake_fd);
+    ring_free(&inbox->ring);
+}
+
+// Function to pass a reply to the inbox's owner. A full inbox drops it, the same as the network
+// dropping it, and the owner recovers the same way.
+static void inbox_push(Inbox *inbox, const char *buffer, int n) {
+    Reply *reply = ring_reserve(&inbox->ring);
+    if (reply == NULL) {
+        return;
+    }
+    reply->length = n;
+    memcpy(reply->data, buffer, n);
+    ring_commit(&inbox->ring);
+    uint64_t one = 1;
+    if (write(inbox->wake_fd, &one, sizeof(one)) < 0) {
+        perror("Failed to signal inbox");
+    }
+}
+
+// Function to wait up to timeout for a reply in the inbox, or on the socket when inbox is NULL.
+// Returns a positive value when one may be ready; a wakeup for replies already taken is possible.
+static int wait_reply(int sockfd, Inbox *inbox, const struct timespec *timeout) {
+    if (inbox != NULL && !ring_empty(&inbox->ring)) {
+        return 1;
+    }
+    struct pollfd pfd = {
+        .fd = inbox != NULL ? inbox->wake_fd : sockfd,
+        .events = POLLIN,
+    };
+    int ready = ppoll(&pfd, 1, timeout, NULL);
+    if (ready > 0 && inbox != NULL) {
+        // Replies pushed after this read signal again, so none is slept through
+        uint64_t value;
+        if (read(inbox->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+            perror("Failed to read inbox wakeup");
+        }
+    }
+    return ready;
+}
+
+// Function to take the next reply without blocking, copying at most capacity bytes of it.
+// Returns the bytes copied, or -1 when there is no reply.
+static int recv_reply(int sockfd, Inbox *inbox, char *buffer, size_t capacity) {
+    if (inbox == NULL) {
+        return recvfrom(sockfd, buffer, capacity, MSG_DONTWAIT, NULL, NULL);
+    }
+    Reply *reply = ring_peek(&inbox->ring);
+    if (reply == NULL) {
+        return -1;
+    }
+    size_t n = reply->length < capacity ? reply->length : capacity;
+    memcpy(buffer, reply->data, n);
+    ring_release(&inbox->ring);
+    return n;
+}
+
+// Function to check whether a file transfer response answers the request with this ID. A server
+// that predates request IDs echoes none, and its responses are taken as they come.
+static int response_answers(const CP_FileTransferResponseView *response, uint32_t request_id) {
+    return response->request_id == 0 || response->request_id == request_id;
+}
+
+// Function to find the inbox a reply belongs to, or NULL for replies nobody waits for (late
+// acknowledgments of finished uploads, path probes and hellos)
+static Inbox *route_reply(TransferManager *manager, const char *buffer, int n) {
+    CP_FileTransferResponseView response;
+    CP_FileSegmentSackView sack;
+    CP_FileSegmentAckView ack;
+    CP_ChunkManifestAckView manifest_ack;
+    uint32_t file_id;
+    Inbox *inbox = NULL;
+
+    switch (view_message_type(buffer, n)) {
+    case CP_TEXT_MESSAGE:
+        return &manager->text;
+    case CP_FILE_TRANSFER_RESPONSE:
+        // Bind the requester to its file ID before any acknowledgment for it can arrive. A late
+        // answer to an earlier request is dropped rather than bound to the next requester.
+        pthread_mutex_lock(&manager->lock);
+        inbox = manager->requester;
+        if (inbox != NULL && (view_file_transfer_response(buffer, n, &response) < 0 || !response_answers(&response, manager->requester_id))) {
+            inbox = NULL;
+        } else if (inbox != NULL && response.status == CP_TRANSFER_ACCEPTED) {
+            inbox->file_id = response.file_id;
+            inbox->bound = 1;
+        }
+        pthread_mutex_unlock(&manager->lock);
+        return inbox;
+    case CP_FILE_SEGMENT_SACK:
+        if (view_file_segment_sack(buffer, n, &sack) < 0) {
+            return NULL;
+        }
+        file_id = sack.file_id;
+        break;
+    case CP_FILE_SEGMENT_ACK:
+        if (view_file_segment_ack(buffer, n, &ack) < 0) {
+            return NULL;
+        }
+        file_id = ack.file_id;
+        break;
+    case CP_CHUNK_MANIFEST_ACK:
+        if (view_chunk_manifest_ack(buffer, n, &manifest_ack) < 0) {
+            return NULL;
+        }
+        file_id = manifest_ack.file_id;
+        break;
+    default:
+        return NULL;
+    }
+
+    pthread_mutex_lock(&manager->lock);
+    for (int i = 0; i < manager->upload_count; i++) {
+        if (manager->uploads[i].bound && manager->uploads[i].file_id == file_id) {
+            inbox = &manager->uploads[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&manager->lock);
+    return inbox;
+}
+
+// Function run by the receive thread: read every datagram that arrives on the client's socket and
+// route it, until stop_fd is signalled
+static void *receive_main(void *arg) {
+    TransferManager *manager = arg;
+    char buffer[sizeof(((Reply *)0)->data)];
+    struct pollfd pfds[2] = {
+        {.fd = manager->sockfd, .events = POLLIN},
+        {.fd = manager->stop_fd, .events = POLLIN},
+    };
+    while (1) {
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to poll socket");
+            break;
+        }
+        if (pfds[1].revents & POLLIN) {
+            break;
+        }
+        int n;
+        while ((n = recvfrom(manager->sockfd, buffer, sizeof(buffer), MSG_DONTWAIT, NULL, NULL)) > 0) {
+            Inbox *inbox = route_reply(manager, buffer, n);
+            if (inbox != NULL) {
+                inbox_push(inbox, buffer, n);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Function to check whether another upload thread is sending a file of this name
+static int upload_active(const TransferManager *manager, const char *filename) {
+    for (int i = 0; i < manager->upload_count; i++) {
+        if (manager->active[i] != NULL && strcmp(manager->active[i]->filename, filename) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Function to take the oldest queued file no other thread is sending a file of the same name,
+// waiting for one; returns NULL once the manager is closing and the queue is empty
+static UploadJob *next_upload(TransferManager *manager, int index) {
+    pthread_mutex_lock(&manager->lock);
+    while (1) {
+        UploadJob *prev = NULL;
+        UploadJob *job = manager->head;
+        while (job != NULL && upload_active(manager, job->filename)) {
+            prev = job;
+            job = job->next;
+        }
+        if (job != NULL) {
+            if (prev != NULL) {
+                prev->next = job->next;
+            } else {
+                manager->head = job->next;
+            }
+            if (manager->tail == job) {
+                manager->tail = prev;
+            }
+            manager->active[index] = job;
+            pthread_mutex_unlock(&manager->lock);
+            return job;
+        }
+        if (manager->head == NULL && manager->closing) {
+            pthread_mutex_unlock(&manager->lock);
+            return NULL;
+        }
+        pthread_cond_wait(&manager->queued, &manager->lock);
+    }
+}
+
+// Function run by each upload thread: upload queued files one after another, receiving through
+// the thread's own inbox
+static void *upload_main(void *arg) {
+    Inbox *inbox = arg;
+    TransferManager *manager = &transfer_manager;
+    int index = inbox - manager->uploads;
+    UploadJob *job;
+    while ((job = next_upload(manager, index)) != NULL) {
+        send_file_transfer_request(manager->sockfd, &manager->servaddr, manager->len, inbox, job->filename, job->flags);
+
+        // A file of the same name may have been waiting for this one
+        pthread_mutex_lock(&manager->lock);
+        inbox->bound = 0;
+        manager->active[index] = NULL;
+        pthread_cond_broadcast(&manager->queued);
+        pthread_mutex_unlock(&manager->lock);
+        free(job);
+    }
+    return NULL;
+}
+
+// Function to start the configured number of upload threads, each with its own inbox, and then
+// the receive thread that fills the inboxes
+static int transfer_manager_start(int sockfd, struct sockaddr_in *servaddr, socklen_t len) {
+    TransferManager *manager = &transfer_manager;
+    manager->sockfd = sockfd;
+    manager->servaddr = *servaddr;
+    manager->len = len;
+    pthread_mutex_init(&manager->lock, NULL);
+    pthread_mutex_init(&manager->request_lock, NULL);
+    pthread_cond_init(&manager->queued, NULL);
+    manager->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (manager->stop_fd < 0 || inbox_init(&manager->text) < 0) {
+        perror("Failed to set up transfer manager");
+        return -1;
+    }
+
+    while (manager->upload_count < client_config.uploads) {
+        Inbox *inbox = &manager->uploads[manager->upload_count];
+        if (inbox_init(inbox) < 0) {
+            perror("Failed to set up upload inbox");
+            break;
+        }
+        if ((errno = pthread_create(&manager->upload_threads[manager->upload_count], NULL, upload_main, inbox)) != 0) {
+            perror("Failed to start upload thread");
+            inbox_free(inbox);
+            break;
+        }
+        manager->upload_count++;
+    }
+    if (manager->upload_count == 0) {
+        LOG_ERROR("No upload thread could be started");
+        return -1;
+    }
+    if ((errno = pthread_create(&manager->receive_thread, NULL, receive_main, manager)) != 0) {
+        perror("Failed to start receive thread");
+        return -1;
+    }
+    LOG_DEBUG("Transfer manager running %d upload threads", manager->upload_count);
+    return 0;
+}
+
+// Function to add a file to the upload queue
+static void queue_upload(const char *filename, uint8_t flags) {
+    TransferManager *manager = &transfer_manager;
+    UploadJob *job = malloc(sizeof(*job));
+    if (job == NULL) {
+        perror("Failed to queue upload");
+        handle_transition(ERROR);
+        return;
+    }
+    snprintf(job->filename, sizeof(job->filename), "%s", filename);
+    job->flags = flags;
+    job->next = NULL;
+
+    pthread_mutex_lock(&manager->lock);
+    if (manager->tail != NULL) {
+        manager->tail->next = job;
+    } else {
+        manager->head = job;
+    }
+    manager->tail = job;
+    pthread_cond_signal(&manager->queued);
+    pthread_mutex_unlock(&manager->lock);
+    LOG_INFO("Upload queued: %s", filename);
+}
+
+// Function to let the upload threads finish the queue, then stop them and the receive thread
+static void transfer_manager_stop(void) {
+    TransferManager *manager = &transfer_manager;
+    pthread_mutex_lock(&manager->lock);
+    manager->closing = 1;
+    pthread_cond_broadcast(&manager->queued);
+    pthread_mutex_unlock(&manager->lock);
+    for (int i = 0; i < manager->upload_count; i++) {
+        pthread_join(manager->upload_threads[i], NULL);
+    }
+
+    uint64_t one = 1;
+    if (write(manager->stop_fd, &one, sizeof(one)) < 0) {
+        perror("Failed to stop receive thread");
+    }
+    pthread_join(manager->receive_thread, NULL);
+    for (int i = 0; i < manager->upload_count; i++) {
+        inbox_free(&manager->uploads[i]);
+    }
+    inbox_free(&manager->text);
+    close(manager->stop_fd);
+}
+
+// Function to send a request and wait for the server's answer of type answer_type, skipping other
+// datagrams such as late acknowledgments of an earlier transfer, probe or manifest. Replies are
+// read from the inbox the receive thread fills, or from the socket itself when inbox is NULL. A request left
+// unanswered is sent again with a doubled timeout, up to REQUEST_ATTEMPTS times. A file transfer
+// response is only taken if it answers request_id. Returns the answer's size in reply, or -1 if
+// none came.
+static int send_request(int sockfd, struct sockaddr_in *servaddr, socklen_t len, Inbox *inbox, const void *request, size_t size, char *reply, size_t capacity, int answer_type, uint32_t request_id) {
+    int timeout = REQUEST_TIMEOUT_MS;
+    for (int attempt = 0; attempt < REQUEST_ATTEMPTS; attempt++, timeout *= 2) {
+        if (attempt > 0) {
+            LOG_DEBUG("No answer within %d ms, sending the request again", timeout / 2);
+        }
+        sendto(sockfd, request, size, MSG_CONFIRM, (const struct sockaddr *)servaddr, len);
+
+        uint64_t deadline = now_ms() + timeout;
+        uint64_t now;
+        while ((now = now_ms()) < deadline) {
+            struct timespec wait = {
+                .tv_sec = (deadline - now) / 1000,
+                .tv_nsec = (deadline - now) % 1000 * 1000000,
+            };
+            if (wait_reply(sockfd, inbox, &wait) <= 0) {
+                break;
+            }
+            int n;
+            while ((n = recv_reply(sockfd, inbox, reply, capacity)) > 0) {
+                CP_FileTransferResponseView response;
+                if (view_message_type(reply, n) != answer_type) {
+                    continue;
+                }
+                if (answer_type == CP_FILE_TRANSFER_RESPONSE &&
+                    (view_file_transfer_response(reply, n, &response) < 0 || !response_answers(&response, request_id))) {
+                    LOG_DEBUG("Dropped a file transfer response to an earlier request");
+                    continue;
+                }
+                return n;
+            }
+        }
+    }
+    LOG_WARN("No answer from the server after %d attempts", REQUEST_ATTEMPTS);
+    return -1;
+}
+
+// Function to send a file transfer request under a fresh request ID and wait for the server's
+// answer to it. The server answers a repeated request with the transfer the first one opened.
+// Over the shared socket, the receive thread binds inbox to the accepted file ID. Returns 0 if
+// the transfer was accepted, or -1 after reporting why not.
+static int request_file_transfer(int sockfd, struct sockaddr_in *servaddr, socklen_t len, Inbox *inbox, CP_FileTransferRequest *request, CP_FileTransferResponseView *response) {
+    char buffer[MAX_MESSAGE_SIZE + sizeof(CP_Header)];
+    int n;
+    uint32_t request_id = __atomic_add_fetch(&last_request_id, 1, __ATOMIC_RELAXED);
+    if (request_id == 0) {
+        // 0 stands for no ID; skip it when the counter wraps
+        request_id = __atomic_add_fetch(&last_request_id, 1, __ATOMIC_RELAXED);
+    }
+    request->request_id = request_id;
+    if (inbox != NULL) {
+        // The receive thread can route only the one outstanding response, so uploads sharing the
+        // socket ask one at a time
+        TransferManager *manager = &transfer_manager;
+        pthread_mutex_lock(&manager->request_lock);
+        pthread_mutex_lock(&manager->lock);
+        manager->requester = inbox;
+        manager->requester_id = request_id;
+        pthread_mutex_unlock(&manager->lock);
+        n = send_request(sockfd, servaddr, len, inbox, request, sizeof(*request), buffer, sizeof(buffer), CP_FILE_TRANSFER_RESPONSE, request_id);
+        pthread_mutex_lock(&manager->lock);
+        manager->requester = NULL;
+        pthread_mutex_unlock(&manager->lock);
+        pthread_mutex_unlock(&manager->request_lock);
+    } else {
+        n = send_request(sockfd, servaddr, len, NULL, request, sizeof(*request), buffer, sizeof(buffer), CP_FILE_TRANSFER_RESPONSE, request_id);
+    }
+    if (n < 0) {
+        return -1;
+    }
+    if (view_file_transfer_response(buffer, n, response) < 0) {
+        LOG_WARN("Invalid file transfer response received");
+        return -1;
+    }
+    if (response->status != CP_TRANSFER_ACCEPTED) {
+        LOG_WARN("File transfer rejected by server: %s", response->status == CP_TRANSFER_NO_SPACE ? "not enough space" : "could not create file");
+        return -1;
+    }
+    return 0;
+}
+
+// One byte range of a striped upload, sent by its own thread from its own socket. The socket's
+// source port differs from the other stripes', so the server's reuseport hash spreads the
+// stripes over its workers.
+typedef struct {
+    int sockfd;
+    struct sockaddr_in servaddr;
+    Inbox *inbox; // Where the first stripe's replies arrive; NULL for the others, which read their own sockets
+    FILE *file;
+    uint64_t offset;
+    uint64_t length;
+    uint32_t file_id;
+    uint16_t segment_size;
+    pthread_t thread;
+} FileStripe;
+
+// Function run by each stripe thread
+static void *stripe_main(void *arg) {
+    FileStripe *stripe = arg;
+    send_file_segments(stripe->sockfd, &stripe->servaddr, sizeof(stripe->servaddr), stripe->inbox, stripe->file, stripe->offset, stripe->length, stripe->file_id, stripe->segment_size, 0, 0);
+    return NULL;
+}
+
+// Function to send the rest of a striped upload whose first stripe the server accepted as
+// first->file_id. Each further stripe opens a socket and requests its range into the same file;
+// then all stripes are sent in parallel, the first from the calling thread.
+static void send_file_stripes(const char *filename, uint64_t file_size, FileStripe *stripes, int count) {
+    int opened = 1;
+    for (; opened < count; opened++) {
+        FileStripe *stripe = &stripes[opened];
+        if ((stripe->sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+            perror("Socket creation failed");
+            break;
+        }
+        CP_FileTransferRequest request;
+        encode_file_stripe_request(&request, filename, file_size, stripes[0].segment_size, stripes[0].file_id, stripe->offset, stripe->length);
+        CP_FileTransferResponseView response;
+        if (request_file_transfer(stripe->sockfd, &stripe->servaddr, sizeof(stripe->servaddr), NULL, &request, &response) < 0) {
+            close(stripe->sockfd);
+            break;
+        }
+        stripe->file_id = response.file_id;
+        stripe->segment_size = response.segment_size;
+        LOG_DEBUG("Stripe %d of %s: file ID %u, bytes %" PRIu64 " to %" PRIu64, opened, filename, stripe->file_id, stripe->offset, stripe->offset + stripe->length);
+    }
+    if (opened < count) {
+        LOG_WARN("Could not open stripe %d of %s", opened, filename);
+        handle_transition(ERROR);
+        for (int i = 1; i < opened; i++) {
+            close(stripes[i].sockfd);
+        }
+        return;
+    }
+
+    int started = 1;
+    for (; started < count; started++) {
+        if ((errno = pthread_create(&stripes[started].thread, NULL, stripe_main, &stripes[started])) != 0) {
+            perror("Failed to start stripe thread");
+            break;
+        }
+    }
+    stripe_main(&stripes[0]);
+    for (int i = started; i < count; i++) {
+        stripe_main(&stripes[i]);
+    }
+    for (int i = 1; i < count; i++) {
+        if (i < started) {
+            pthread_join(stripes[i].thread, NULL);
+        }
+        close(stripes[i].sockfd);
+    }
+}
+
+// Function to remember the token the server gave an upload in "<filename>.upload", so that a
+// later resume of the file can name the upload
+static void save_upload_token(const char *filename, uint64_t upload_token) {
+    char path[MAX_FILENAME_LENGTH + 8];
+    snprintf(path, sizeof(path), "%s.upload", filename);
+    FILE *file = fopen(path, "w");
+    if (file == NULL || fprintf(file, "%016" PRIx64 "\n", upload_token) < 0 || fclose(file) != 0) {
+        perror("Failed to save upload token");
+    }
+}
+
+// Function to read the token saved for an upload of this file; returns 0 when there is none
+static uint64_t load_upload_token(const char *filename) {
+    char path[MAX_FILENAME_LENGTH + 8];
+    snprintf(path, sizeof(path), "%s.upload", filename);
+    FILE *file = fopen(path, "r");
+    uint64_t upload_token = 0;
+    if (file != NULL) {
+        if (fscanf(file, "%" SCNx64, &upload_token) != 1) {
+            upload_token = 0;
+        }
+        fclose(file);
+    }
+    return upload_token;
+}
+
+// Function to remove the token of an upload that has finished
+static void forget_upload_token(const char *filename) {
+    char path[MAX_FILENAME_LENGTH + 8];
+    snprintf(path, sizeof(path), "%s.upload", filename);
+    unlink(path);
+}
+
 // Function to send a file transfer request to the server
-void send_file_transfer_request(int sockfd, struct sockaddr_in *servaddr, socklen_t len, const char *filename) {
+void send_file_transfer_request(int sockfd, struct sockaddr_in *servaddr, socklen_t len, Inbox *inbox, const char *filename, uint8_t flags) {
     FILE *file = fopen(filename, "rb");
     if (file == NULL) {
         perror("Failed to open file");
@@ -141,60 +1089,728 @@ void send_file_transfer_request(int sockfd, struct sockaddr_in *servaddr, sockle
     uint64_t file_size = ftell(file);
     fseek(file, 0, SEEK_SET);
 
+    // Split a large new upload into stripes of whole segments, one per configured socket
+    int stripe_count = client_config.stripes;
+    if ((uint64_t)stripe_count * MIN_STRIPE_BYTES > file_size) {
+        stripe_count = file_size / MIN_STRIPE_BYTES > 1 ? file_size / MIN_STRIPE_BYTES : 1;
+    }
+    if (flags & CP_TRANSFER_RESUME) {
+        stripe_count = 1;
+    }
+    FileStripe stripes[MAX_STRIPES];
+    uint64_t total_segments = (file_size + client_config.segment_size - 1) / client_config.segment_size;
+    for (int i = 0; i < stripe_count; i++) {
+        uint64_t start = total_segments * i / stripe_count * client_config.segment_size;
+        uint64_t end = i + 1 == stripe_count ? file_size : total_segments * (i + 1) / stripe_count * client_config.segment_size;
+        stripes[i] = (FileStripe){
+            .sockfd = sockfd,
+            .servaddr = *servaddr,
+            .inbox = i == 0 ? inbox : NULL,
+            .file = file,
+            .offset = start,
+            .length = end - start,
+        };
+    }
+
     // Encode and send the file transfer request
     CP_FileTransferRequest request;
-    encode_file_transfer_request(&request, filename, file_size);
-    sendto(sockfd, &request, sizeof(request), MSG_CONFIRM, (const struct sockaddr *)servaddr, len);
+    if (stripe_count > 1) {
+        encode_file_stripe_request(&request, filename, file_size, client_config.segment_size, 0, 0, stripes[0].length);
+    } else {
+        // A file within one chunk is sent outright; a manifest round trip would not save anything
+        if (client_config.dedup && file_size > CHUNK_MAX_SIZE) {
+            flags |= CP_TRANSFER_DEDUP;
+        }
+        encode_file_transfer_request(&request, filename, file_size, client_config.segment_size, flags);
+        if (flags & CP_TRANSFER_RESUME) {
+            request.upload_token = load_upload_token(filename);
+            if (request.upload_token == 0) {
+                LOG_WARN("No upload of %s to resume, sending it from the start", filename);
+            }
+        }
+    }
+    LOG_INFO("File transfer request sent: %s (Size: %" PRIu64 " bytes)", filename, file_size);
 
-    printf("File transfer request sent: %s (Size: %" PRIu64 " bytes)\n", filename, file_size);
+    // Receive the file ID and segment size assigned by the server
+    CP_FileTransferResponseView response;
+    if (request_file_transfer(sockfd, servaddr, len, inbox, &request, &response) < 0) {
+        handle_transition(ERROR);
+        fclose(file);
+        return;
+    }
+    uint32_t file_id = response.file_id;
+    LOG_DEBUG("File ID %u uses segments of %u bytes", file_id, response.segment_size);
+    if (response.received_segments > 0) {
+        LOG_INFO("Resuming file ID %u at segment %u", file_id, response.received_segments);
+    }
+    if (request.upload_token != 0 && !(response.flags & CP_TRANSFER_RESUME)) {
+        LOG_WARN("Server could not resume %s, sending it from the start", filename);
+    }
+    if (response.upload_token != 0) {
+        save_upload_token(filename, response.upload_token);
+    }
 
-    // Send the file segments
-    send_file_segments(sockfd, servaddr, len, file, request.header.length);
+    // A server that does not stripe takes the first request for the whole file
+    if (stripe_count > 1 && (response.flags & CP_TRANSFER_STRIPE)) {
+        LOG_INFO("Striping file ID %u across %d sockets", file_id, stripe_count);
+        stripes[0].file_id = file_id;
+        stripes[0].segment_size = response.segment_size;
+        send_file_stripes(filename, file_size, stripes, stripe_count);
+        fclose(file);
+        return;
+    }
+
+    // Send the file segments; a finished upload has nothing left to resume
+    if (send_file_segments(sockfd, servaddr, len, inbox, file, 0, file_size, file_id, response.segment_size, response.received_segments, response.flags & CP_TRANSFER_DEDUP) == 0 &&
+        response.upload_token != 0) {
+        forget_upload_token(filename);
+    }
     fclose(file);
 }
 
-// Function to send file segments to the server
-void send_file_segments(int sockfd, struct sockaddr_in *servaddr, socklen_t len, FILE *file, uint32_t file_id) {
-    uint32_t segment_number = 0;
-    char segment_data[FILE_SEGMENT_SIZE];
-    size_t bytes_read;
+// Function to wait for this thread's turn to send a burst
+static void send_turn_take(SendTurns *turns) {
+    pthread_mutex_lock(&turns->lock);
+    uint64_t ticket = turns->next_ticket++;
+    while (turns->serving != ticket) {
+        pthread_cond_wait(&turns->turn, &turns->lock);
+    }
+    pthread_mutex_unlock(&turns->lock);
+}
 
-    // Read and send file segments
-    while ((bytes_read = fread(segment_data, 1, FILE_SEGMENT_SIZE, file)) > 0) {
-        CP_FileSegment segment;
-        encode_file_segment(&segment, file_id, segment_number, segment_data, bytes_read);
-        sendto(sockfd, &segment, sizeof(segment), MSG_CONFIRM, (const struct sockaddr *)servaddr, len);
+// Function to hand the turn to the next waiting thread
+static void send_turn_pass(SendTurns *turns) {
+    pthread_mutex_lock(&turns->lock);
+    turns->serving++;
+    pthread_cond_broadcast(&turns->turn);
+    pthread_mutex_unlock(&turns->lock);
+}
 
-        printf("File segment %u sent (Size: %zu bytes)\n", segment_number, bytes_read);
+// Function to send count segments to the server, each gathered from two iovecs: its header in the
+// window and its payload in the mapped file. With GSO enabled they leave in a single sendmsg and
+// the kernel splits them into datagrams of gso_size bytes (only the last may be shorter); otherwise,
+// or if the kernel rejects UDP_SEGMENT, each segment is sent with its own sendmsg. Uploads sharing
+// the socket take turns, one burst each; turns is NULL when the socket is this upload's own.
+static void send_segment_burst(int sockfd, struct sockaddr_in *servaddr, socklen_t len, SendTurns *turns, struct iovec *iov, int count, uint16_t gso_size) {
+    // Cleared by whichever thread sees the kernel reject UDP_SEGMENT first
+    static int gso_supported = 1;
+    if (turns != NULL) {
+        send_turn_take(turns);
+    }
+    struct msghdr msg = {
+        .msg_name = servaddr,
+        .msg_namelen = len,
+    };
 
-        // Receive acknowledgment for the sent segment
-        char buffer[sizeof(CP_FileSegmentAck)];
-        int n = recvfrom(sockfd, buffer, sizeof(buffer), MSG_WAITALL, (struct sockaddr *)servaddr, &len);
-        if (n > 0) {
-            CP_FileSegmentAck ack;
-            memcpy(&ack, buffer, sizeof(ack));
-            uint32_t ack_file_id, ack_segment_number;
-            decode_file_segment_ack(&ack, &ack_file_id, &ack_segment_number);
+    if (count > 1 && __atomic_load_n(&gso_supported, __ATOMIC_RELAXED)) {
+        char control[CMSG_SPACE(sizeof(uint16_t))];
+        memset(control, 0, sizeof(control));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2 * count;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
 
-            if (ack_file_id == file_id && ack_segment_number == segment_number) {
-                printf("Acknowledgment received for segment %u\n", segment_number);
-            } else {
-                printf("Invalid acknowledgment received\n");
-                handle_transition(ERROR);
-                return;
+        if (sendmsg(sockfd, &msg, 0) >= 0) {
+            if (turns != NULL) {
+                send_turn_pass(turns);
             }
-        } else {
-            handle_transition(ERROR);
             return;
         }
+        perror("UDP GSO send failed, sending segments individually");
+        __atomic_store_n(&gso_supported, 0, __ATOMIC_RELAXED);
+        msg.msg_control = NULL;
+        msg.msg_controllen = 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        msg.msg_iov = &iov[2 * i];
+        msg.msg_iovlen = 2;
+        sendmsg(sockfd, &msg, MSG_CONFIRM);
+    }
+    if (turns != NULL) {
+        send_turn_pass(turns);
+    }
+}
+
+// Segments in flight: encoded headers by window slot (segment n lives at n % size) and the
+// mapped file their payloads are sent from
+typedef struct {
+    CP_FileSegmentHeader *headers;
+    uint32_t size;
+    const char *data;
+    uint16_t segment_size; // Payload of every segment but the last
+    uint8_t codec; // Codec segments are compressed with, CP_CODEC_NONE to send them as is
+    char *compressed; // segment_size bytes holding the segment being compressed
+    uint64_t *sent_at; // Time each slot's segment was last sent, in microseconds
+    uint8_t *transmissions; // Times each slot's segment was sent, so retransmissions give no RTT sample
+    SendTurns *turns; // Turns at the shared socket, or NULL when the socket is this upload's own
+} SegmentWindow;
+
+// Function to compress a segment's payload into the window's scratch buffer when a sample of it
+// looks compressible; returns the compressed size, or 0 to send the payload as is
+static size_t compress_segment(const SegmentWindow *window, const CP_FileSegmentHeader *header, const char *payload) {
+    if (window->codec == CP_CODEC_NONE || !codec_worthwhile(payload, header->segment_size)) {
+        return 0;
+    }
+    uint16_t size = header->segment_size;
+    return codec_compress(window->codec, payload, size, window->compressed, size - size / COMPRESSION_MIN_SAVING);
+}
+
+// Function to send segments first..last-1 in bursts of up to gso_segments that stay within one
+// UDP send. Neither the headers nor the payloads are copied; the iovecs point at them in place.
+// A segment that compresses ends the burst before it and is sent on its own, since GSO needs
+// datagrams of equal size.
+static void send_segment_range(int sockfd, struct sockaddr_in *servaddr, socklen_t len, const SegmentWindow *window, uint32_t first, uint32_t last) {
+    struct iovec iov[2 * MAX_GSO_SEGMENTS];
+    size_t datagram_size = file_segment_wire_size(window->segment_size);
+    uint32_t max_burst = CP_MAX_DATAGRAM_SIZE / datagram_size;
+    if (max_burst > (uint32_t)client_config.gso_segments) {
+        max_burst = client_config.gso_segments;
+    }
+    uint64_t now = now_us();
+    for (uint32_t segment = first; segment != last; segment++) {
+        window->sent_at[segment % window->size] = now;
+        window->transmissions[segment % window->size]++;
+    }
+    while (first != last) {
+        uint32_t count = 0;
+        size_t compressed = 0;
+        while (first + count != last && count < max_burst) {
+            uint32_t segment = first + count;
+            CP_FileSegmentHeader *header = &window->headers[segment % window->size];
+            const char *payload = window->data + (uint64_t)segment * window->segment_size;
+            if ((compressed = compress_segment(window, header, payload)) > 0) {
+                break;
+            }
+            iov[2 * count].iov_base = header;
+            iov[2 * count].iov_len = file_segment_wire_size(0);
+            iov[2 * count + 1].iov_base = (void *)payload;
+            iov[2 * count + 1].iov_len = header->segment_size;
+            count++;
+        }
+        if (count > 0) {
+            send_segment_burst(sockfd, servaddr, len, window->turns, iov, count, datagram_size);
+            first += count;
+        }
+        if (compressed > 0) {
+            CP_FileSegmentHeader header;
+            const CP_FileSegmentHeader *raw = &window->headers[first % window->size];
+            encode_compressed_segment_header(&header, raw->file_id, first, compressed, window->codec, raw->crc32c);
+            iov[0].iov_base = &header;
+            iov[0].iov_len = file_segment_wire_size(0);
+            iov[1].iov_base = window->compressed;
+            iov[1].iov_len = compressed;
+            send_segment_burst(sockfd, servaddr, len, window->turns, iov, 1, 0);
+            first++;
+        }
+    }
+}
+
+// Function to resend every segment between first and last that has not been selectively acknowledged
+static void send_missing_segments(int sockfd, struct sockaddr_in *servaddr, socklen_t len, const SegmentWindow *window, const uint8_t *acked, uint32_t first, uint32_t last) {
+    while (first != last) {
+        if (acked[first % window->size]) {
+            first++;
+            continue;
+        }
+        uint32_t run_end = first;
+        while (run_end != last && !acked[run_end % window->size]) {
+            run_end++;
+        }
+        send_segment_range(sockfd, servaddr, len, window, first, run_end);
+        first = run_end;
+    }
+}
+
+// Function to resend the segments between first and last that acknowledgments show lost: not
+// acknowledged, though sent before overtaken_us, the send time of the latest segment acknowledged.
+// A resent segment is stamped anew, so it is only resent again once a later segment overtakes it.
+// Returns the number of segments resent and the first of them in first_lost.
+static uint32_t send_lost_segments(int sockfd, struct sockaddr_in *servaddr, socklen_t len, const SegmentWindow *window, const uint8_t *acked, uint32_t first, uint32_t last, uint64_t overtaken_us, uint32_t *first_lost) {
+    uint32_t count = 0;
+    while (first != last) {
+        uint32_t run_end = first;
+        while (run_end != last && !acked[run_end % window->size] && window->sent_at[run_end % window->size] < overtaken_us) {
+            run_end++;
+        }
+        if (run_end == first) {
+            first++;
+            continue;
+        }
+        if (count == 0) {
+            *first_lost = first;
+        }
+        send_segment_range(sockfd, servaddr, len, window, first, run_end);
+        count += run_end - first;
+        first = run_end;
+    }
+    return count;
+}
+
+// Function to record a segment newly acknowledged: the latest send time of any acknowledged
+// segment, against which losses are judged, and of those sent only once, which give RTT samples
+// (Karn's rule: a retransmitted segment's acknowledgment may be for either transmission)
+static void note_acknowledged(const SegmentWindow *window, uint32_t slot, uint64_t *newest_sent, uint64_t *newest_sent_once) {
+    if (window->sent_at[slot] > *newest_sent) {
+        *newest_sent = window->sent_at[slot];
+    }
+    if (window->transmissions[slot] == 1 && window->sent_at[slot] > *newest_sent_once) {
+        *newest_sent_once = window->sent_at[slot];
+    }
+}
+
+// Function to mark the segments lying wholly inside the file range start..end-1, which the server
+// filled in from its chunk store. The server marks exactly the same segments as received.
+static void mark_covered_segments(uint64_t *covered, uint64_t start, uint64_t end, uint64_t file_size, uint16_t segment_size) {
+    uint32_t first = (start + segment_size - 1) / segment_size;
+    uint32_t last = end == file_size ? (file_size + segment_size - 1) / segment_size : end / segment_size;
+    for (uint32_t segment = first; segment < last; segment++) {
+        covered[segment / 64] |= (uint64_t)1 << (segment % 64);
+    }
+}
+
+// Function to send one part of the chunk manifest, encoded in the caller's manifest buffer: up to
+// per_part chunks starting at part * per_part
+static void send_manifest_part(int sockfd, struct sockaddr_in *servaddr, socklen_t len, CP_ChunkManifest *manifest, uint32_t file_id, const CP_ChunkEntry *chunks, uint32_t chunk_count, uint32_t per_part, const uint64_t *part_offsets, uint32_t part) {
+    uint32_t first = part * per_part;
+    uint16_t count = chunk_count - first < per_part ? chunk_count - first : per_part;
+    size_t size = encode_chunk_manifest(manifest, file_id, chunk_count, first, part_offsets[part], &chunks[first], count);
+    sendto(sockfd, manifest, size, MSG_CONFIRM, (const struct sockaddr *)servaddr, len);
+}
+
+// Function to cut the file into content-defined chunks, announce their hashes to the server and
+// learn which chunks it already stores. Manifest parts are sized to the negotiated segment, kept
+// MANIFEST_WINDOW in flight and resent on the segment retransmission timeout. Returns a bitmap of
+// the segments the server filled in from its store, or NULL when there are none.
+static uint64_t *exchange_chunk_manifest(int sockfd, struct sockaddr_in *servaddr, socklen_t len, Inbox *inbox, const uint8_t *data, uint64_t file_size, uint32_t file_id, uint16_t segment_size) {
+    CP_ChunkEntry *chunks = NULL;
+    uint32_t chunk_count = 0;
+    uint32_t chunk_capacity = 0;
+    for (uint64_t offset = 0; offset < file_size; offset += chunks[chunk_count++].length) {
+        if (chunk_count == chunk_capacity) {
+            chunk_capacity = chunk_capacity ? chunk_capacity * 2 : 1024;
+            CP_ChunkEntry *grown = realloc(chunks, chunk_capacity * sizeof(*chunks));
+            if (grown == NULL) {
+                perror("Failed to allocate chunk manifest");
+                free(chunks);
+                return NULL;
+            }
+            chunks = grown;
+        }
+        chunks[chunk_count].length = chunk_next(data + offset, file_size - offset);
+        sha256(data + offset, chunks[chunk_count].length, chunks[chunk_count].hash);
+    }
 
-        segment_number++;
+    uint32_t per_part = (file_segment_wire_size(segment_size) - offsetof(CP_ChunkManifest, chunks)) / sizeof(CP_ChunkEntry);
+    if (per_part < 1) {
+        per_part = 1;
+    } else if (per_part > CP_MAX_MANIFEST_CHUNKS) {
+        per_part = CP_MAX_MANIFEST_CHUNKS;
+    }
+    uint32_t part_count = (chunk_count + per_part - 1) / per_part;
+    uint64_t *part_offsets = malloc(part_count * sizeof(uint64_t));
+    uint8_t *part_acked = calloc(part_count, sizeof(uint8_t));
+    uint64_t *covered = calloc((file_size + segment_size - 1) / segment_size / 64 + 1, sizeof(uint64_t));
+    CP_ChunkManifest *manifest = malloc(sizeof(*manifest));
+    if (part_offsets == NULL || part_acked == NULL || covered == NULL || manifest == NULL) {
+        perror("Failed to allocate chunk manifest");
+        free(manifest);
+        free(covered);
+        free(part_acked);
+        free(part_offsets);
+        free(chunks);
+        return NULL;
+    }
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < chunk_count; i++) {
+        if (i % per_part == 0) {
+            part_offsets[i / per_part] = offset;
+        }
+        offset += chunks[i].length;
+    }
+
+    uint32_t base = 0; // Oldest unacknowledged part
+    uint32_t next = 0; // Next part to send for the first time
+    uint32_t known_chunks = 0;
+    uint64_t known_bytes = 0;
+    int retransmissions = 0;
+    uint64_t deadline = 0;
+    while (base != part_count) {
+        if (next != part_count && next - base < MANIFEST_WINDOW) {
+            if (base == next) {
+                deadline = now_ms() + RETRANSMIT_TIMEOUT_MS;
+            }
+            while (next != part_count && next - base < MANIFEST_WINDOW) {
+                send_manifest_part(sockfd, servaddr, len, manifest, file_id, chunks, chunk_count, per_part, part_offsets, next++);
+            }
+        }
+
+        uint64_t now = now_ms();
+        struct timespec wait = {0, 0};
+        if (deadline > now) {
+            wait.tv_sec = (deadline - now) / 1000;
+            wait.tv_nsec = (deadline - now) % 1000 * 1000000;
+        }
+        if (wait_reply(sockfd, inbox, &wait) > 0) {
+            char buffer[sizeof(CP_ChunkManifestAck)];
+            int n;
+            while ((n = recv_reply(sockfd, inbox, buffer, sizeof(buffer))) > 0) {
+                CP_ChunkManifestAckView ack;
+                if (view_chunk_manifest_ack(buffer, n, &ack) < 0 || ack.file_id != file_id || ack.first_chunk % per_part != 0 ||
+                    ack.first_chunk / per_part >= next || part_acked[ack.first_chunk / per_part]) {
+                    continue; // Late or duplicate reply
+                }
+                uint32_t part = ack.first_chunk / per_part;
+                part_acked[part] = 1;
+                retransmissions = 0;
+                deadline = now_ms() + RETRANSMIT_TIMEOUT_MS;
+
+                // Runs of stored chunks within the part cover the segments the server marked
+                uint64_t chunk_offset = part_offsets[part];
+                uint64_t run_start = chunk_offset;
+                int in_run = 0;
+                for (uint16_t i = 0; i < ack.chunk_count && ack.first_chunk + i < chunk_count; i++) {
+                    uint32_t length = chunks[ack.first_chunk + i].length;
+                    if ((ack.known[i / 8] >> (i % 8)) & 1) {
+                        known_chunks++;
+                        known_bytes += length;
+                        if (!in_run) {
+                            run_start = chunk_offset;
+                            in_run = 1;
+                        }
+                    } else if (in_run) {
+                        mark_covered_segments(covered, run_start, chunk_offset, file_size, segment_size);
+                        in_run = 0;
+                    }
+                    chunk_offset += length;
+                }
+                if (in_run) {
+                    mark_covered_segments(covered, run_start, chunk_offset, file_size, segment_size);
+                }
+            }
+        }
+        while (base != next && part_acked[base]) {
+            base++;
+        }
+
+        // Resend the unacknowledged parts; if the manifest cannot get through, send every segment
+        if (base != next && now_ms() >= deadline) {
+            if (++retransmissions > MAX_RETRANSMISSIONS) {
+                LOG_WARN("Chunk manifest unacknowledged from part %u, sending the remaining chunks in full", base);
+                break;
+            }
+            for (uint32_t part = base; part != next; part++) {
+                if (!part_acked[part]) {
+                    send_manifest_part(sockfd, servaddr, len, manifest, file_id, chunks, chunk_count, per_part, part_offsets, part);
+                }
+            }
+            deadline = now_ms() + RETRANSMIT_TIMEOUT_MS;
+        }
+    }
+    LOG_INFO("Server already stores %u of %u chunks (%" PRIu64 " of %" PRIu64 " bytes)", known_chunks, chunk_count, known_bytes, file_size);
+
+    free(manifest);
+    free(part_acked);
+    free(part_offsets);
+    free(chunks);
+    if (known_chunks == 0) {
+        free(covered);
+        return NULL;
+    }
+    return covered;
+}
+
+// Function to fold the mapped data from *hashed up to end into the whole-file hash. Segments are
+// hashed as they are first queued, so this normally covers one segment; after a jump it also
+// covers the segments skipped, which the server has but the hash still needs.
+static void hash_file_range(Xxh64 *hash, const char *data, uint64_t *hashed, uint64_t end) {
+    if (end > *hashed) {
+        xxh64_update(hash, data + *hashed, end - *hashed);
+        *hashed = end;
+    }
+}
+
+// Function to send file segments to the server with up to window_segments of them unacknowledged.
+// Payloads are sent straight from a read-only mapping of the file, read ahead of the window.
+// The server acknowledges with SACKs: a cumulative count of segments received plus ranges received
+// beyond it. A segment is resent as soon as DUP_THRESHOLD segments beyond it are acknowledged (fast
+// retransmit). When the oldest unacknowledged segment sees no progress for the retransmission
+// timeout, estimated from the RTT and doubled with each timeout in a row, the segments the server has
+// not reported are all sent again. A resumed upload starts at first_segment.
+// With dedup, the file's chunk manifest goes first and segments the server already stores are skipped.
+// Only the file_size bytes at offset are sent, as segments numbered from there (one stripe of a file).
+// The congestion controller narrows the window to its cwnd and paces the bursts sent into it.
+// Each segment carries the CRC-32C of its data, and the completion message the XXH64 of the range.
+// Acknowledgments are read from inbox when the socket is shared with other uploads, else from sockfd.
+// Returns 0 once every segment was acknowledged and the completion sent, or -1 if the upload failed.
+int send_file_segments(int sockfd, struct sockaddr_in *servaddr, socklen_t len, Inbox *inbox, FILE *file, uint64_t offset, uint64_t file_size, uint32_t file_id, uint16_t segment_size, uint32_t first_segment, int dedup) {
+    uint32_t total_segments = (file_size + segment_size - 1) / segment_size;
+    if (first_segment > total_segments) {
+        first_segment = total_segments;
+    }
+    SegmentWindow window = {
+        .size = client_config.window_segments,
+        .segment_size = segment_size,
+        .codec = session_codec,
+        .turns = inbox != NULL ? &send_turns : NULL,
+    };
+
+    // The mapping starts at the page holding offset
+    char *map = NULL;
+    uint64_t map_skip = offset % sysconf(_SC_PAGESIZE);
+    if (file_size > 0) {
+        map = mmap(NULL, map_skip + file_size, PROT_READ, MAP_SHARED, fileno(file), offset - map_skip);
+        if (map == MAP_FAILED) {
+            perror("Failed to map file");
+            handle_transition(ERROR);
+            return -1;
+        }
+        madvise(map, map_skip + file_size, MADV_SEQUENTIAL);
+    }
+    window.data = map != NULL ? map + map_skip : NULL;
+    uint64_t readahead_end = (uint64_t)first_segment * segment_size; // End of the file range already advised for readahead
+    if (readahead_end > file_size) {
+        readahead_end = file_size;
+    }
+
+    window.headers = calloc(window.size, sizeof(*window.headers));
+    window.sent_at = calloc(window.size, sizeof(*window.sent_at));
+    window.transmissions = calloc(window.size, sizeof(*window.transmissions));
+    uint8_t *acked = calloc(window.size, sizeof(uint8_t)); // Selectively acknowledged, per window slot
+    if (window.codec != CP_CODEC_NONE) {
+        window.compressed = malloc(segment_size);
+    }
+    if (window.headers == NULL || window.sent_at == NULL || window.transmissions == NULL || acked == NULL || (window.codec != CP_CODEC_NONE && window.compressed == NULL)) {
+        perror("Failed to allocate segment window");
+        handle_transition(ERROR);
+        free(window.compressed);
+        free(acked);
+        free(window.transmissions);
+        free(window.sent_at);
+        free(window.headers);
+        if (map != NULL) {
+            munmap(map, map_skip + file_size);
+        }
+        return -1;
+    }
+    // Segments the server filled in from its chunk store are never sent
+    uint64_t *covered = NULL;
+    if (dedup && map != NULL) {
+        covered = exchange_chunk_manifest(sockfd, servaddr, len, inbox, (const uint8_t *)window.data, file_size, file_id, segment_size);
+    }
+
+    uint32_t base = first_segment; // Oldest unacknowledged segment
+    uint32_t next = first_segment; // Next segment to send for the first time
+    int retransmissions = 0; // Retransmission timeouts in a row, each doubling the next timeout
+    uint64_t deadline = 0; // Retransmission deadline in microseconds
+    uint32_t highest_acked = base; // One past the highest segment acknowledged
+    uint64_t rack_sent_us = 0; // Send time of the latest segment acknowledged
+    uint32_t dupacks = 0; // Acknowledgments in a row that brought nothing new
+    uint32_t recovery_end = base; // Losses below this segment were already reacted to
+    Xxh64 file_hash; // Over the range from its start up to hashed
+    uint64_t hashed = 0;
+    xxh64_init(&file_hash, 0);
+    CongestionControl cc;
+    cc_init(&cc, client_config.congestion_control, window.size);
+
+    while (next != total_segments || base != next) {
+        // Fill the free part of the congestion window with as many new segments as pacing lets out
+        // now, and send them. Segments covered by the chunk store take no room and no pacing time.
+        uint32_t limit = cc_window(&cc) < window.size ? cc_window(&cc) : window.size;
+        uint32_t budget = cc_pacing_budget(&cc, now_us(), client_config.gso_segments);
+        uint32_t first = next;
+        uint32_t sent = 0;
+        while (next != total_segments && next - base < limit && sent < budget) {
+            uint64_t segment_offset = (uint64_t)next * segment_size;
+            uint16_t size = file_size - segment_offset < segment_size ? file_size - segment_offset : segment_size;
+            const char *payload = window.data + segment_offset;
+            acked[next % window.size] = covered != NULL && ((covered[next / 64] >> (next % 64)) & 1);
+            encode_file_segment_header(&window.headers[next % window.size], file_id, next, size, acked[next % window.size] ? 0 : crc32c(0, payload, size));
+            window.transmissions[next % window.size] = 0;
+            hash_file_range(&file_hash, window.data, &hashed, segment_offset + size);
+            if (!acked[next % window.size]) {
+                LOG_DEBUG("File segment %u sent (Size: %u bytes)", next, size);
+                sent++;
+            }
+            next++;
+        }
+        if (next != first) {
+            // Ask the kernel to read the next window's worth of the file before it is sent
+            uint64_t window_end = (uint64_t)next * segment_size + (uint64_t)window.size * segment_size;
+            if (readahead_end < file_size && window_end > readahead_end) {
+                uint64_t start = (map_skip + readahead_end) & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+                uint64_t end = window_end + READAHEAD_BYTES < file_size ? window_end + READAHEAD_BYTES : file_size;
+                madvise(map + start, map_skip + end - start, MADV_WILLNEED);
+                readahead_end = end;
+            }
+            send_missing_segments(sockfd, servaddr, len, &window, acked, first, next);
+            cc_on_send(&cc, sent, now_us());
+            if (first == base) {
+                deadline = now_us() + cc_retransmit_timeout(&cc, retransmissions);
+            }
+            while (base != next && acked[base % window.size]) {
+                base++;
+            }
+        }
+        if (base == next && (next == total_segments || budget > sent)) {
+            continue;
+        }
+
+        // Wait for acknowledgments until the retransmission deadline, or only until the pacing
+        // timer expires when the window still has room
+        uint64_t now = now_us();
+        uint64_t wake = base != next ? deadline : cc.next_send_us;
+        if (next != total_segments && next - base < limit && cc.next_send_us < wake) {
+            wake = cc.next_send_us;
+        }
+        struct timespec timeout = {0, 0};
+        if (wake > now) {
+            timeout.tv_sec = (wake - now) / 1000000;
+            timeout.tv_nsec = (wake - now) % 1000000 * 1000;
+        }
+        if (wait_reply(sockfd, inbox, &timeout) > 0) {
+            char buffer[sizeof(CP_FileSegmentSack)];
+            int n;
+            while ((n = recv_reply(sockfd, inbox, buffer, sizeof(buffer))) > 0) {
+                CP_FileSegmentSackView sack;
+                CP_FileSegmentAckView ack;
+                uint32_t cumulative; // Every segment below this one is acknowledged
+                uint32_t newly_acked = 0;
+                uint64_t newest_sent = 0; // Send time of the latest segment newly acknowledged
+                uint64_t newest_sent_once = 0; // The same among those sent only once
+                if (view_file_segment_sack(buffer, n, &sack) == 0 && sack.file_id == file_id) {
+                    cumulative = sack.cumulative;
+                    // Mark the reported ranges, clipped to the segments in flight
+                    for (uint16_t r = 0; r < sack.range_count; r++) {
+                        CP_SackRange range;
+                        view_sack_range(&sack, r, &range);
+                        uint32_t start = (int32_t)(range.start - base) < 0 ? base : range.start;
+                        uint32_t end = (int32_t)(range.end - next) > 0 ? next : range.end;
+                        for (uint32_t segment = start; (int32_t)(end - segment) > 0; segment++) {
+                            uint32_t slot = segment % window.size;
+                            if (!acked[slot]) {
+                                acked[slot] = 1;
+                                newly_acked++;
+                                note_acknowledged(&window, slot, &newest_sent, &newest_sent_once);
+                            }
+                        }
+                        if ((int32_t)(end - highest_acked) > 0) {
+                            highest_acked = end;
+                        }
+                    }
+                } else if (view_file_segment_ack(buffer, n, &ack) == 0 && ack.file_id == file_id) {
+                    cumulative = ack.segment_number + 1;
+                } else if (view_message_type(buffer, n) == CP_CHUNK_MANIFEST_ACK) {
+                    continue; // Reply to a manifest part that was sent twice
+                } else {
+                    LOG_WARN("Invalid acknowledgment received");
+                    continue;
+                }
+
+                // Stale and duplicate acknowledgments do not move the window. The server may hold
+                // segments not sent yet, filled in from its chunk store; those are skipped.
+                uint32_t old_base = base;
+                if ((int32_t)(cumulative - base) > 0 && cumulative <= total_segments) {
+                    for (uint32_t segment = base; segment != cumulative && segment != next; segment++) {
+                        uint32_t slot = segment % window.size;
+                        if (!acked[slot]) {
+                            newly_acked++;
+                            note_acknowledged(&window, slot, &newest_sent, &newest_sent_once);
+                        }
+                    }
+                    base = cumulative;
+                    if ((int32_t)(base - next) > 0) {
+                        next = base;
+                    }
+                }
+                while (base != next && acked[base % window.size]) {
+                    base++;
+                }
+                if ((int32_t)(base - highest_acked) > 0) {
+                    highest_acked = base;
+                }
+                if (newest_sent > rack_sent_us) {
+                    rack_sent_us = newest_sent;
+                }
+                dupacks = newly_acked == 0 && base != next ? dupacks + 1 : 0;
+                now = now_us();
+                cc_on_ack(&cc, newly_acked, newest_sent_once != 0 ? now - newest_sent_once : 0, now);
+                if (base != old_base) {
+                    LOG_DEBUG("Acknowledgment received for segments up to %u (cwnd %.1f, srtt %" PRIu64 " us)", base - 1, cc.cwnd, cc.srtt_us);
+                    retransmissions = 0;
+                    deadline = now + cc_retransmit_timeout(&cc, 0);
+                }
+            }
+
+            // Fast retransmit the segments DUP_THRESHOLD or more below the highest acknowledged one
+            // that a later segment overtook, and the oldest one after DUP_THRESHOLD duplicate
+            // acknowledgments once it has had a round trip to arrive. The window shrinks once per
+            // loss episode, which ends when the segments in flight at its start are acknowledged.
+            uint32_t lost_end = (int32_t)(highest_acked - base) > DUP_THRESHOLD ? highest_acked - DUP_THRESHOLD : base;
+            uint32_t first_lost = base;
+            uint32_t lost = 0;
+            if (base != next) {
+                lost = send_lost_segments(sockfd, servaddr, len, &window, acked, base, lost_end, rack_sent_us, &first_lost);
+            }
+            if (dupacks >= DUP_THRESHOLD && lost_end == base && !acked[base % window.size] &&
+                now_us() - window.sent_at[base % window.size] >= cc.srtt_us) {
+                send_segment_range(sockfd, servaddr, len, &window, base, base + 1);
+                first_lost = base;
+                lost = 1;
+            }
+            if (lost > 0) {
+                dupacks = 0;
+                if ((int32_t)(first_lost - recovery_end) >= 0) {
+                    cc_on_loss(&cc, now_us());
+                    recovery_end = next;
+                }
+                cc_on_send(&cc, lost, now_us());
+                LOG_DEBUG("Fast retransmit of %u segments from %u (cwnd %.1f)", lost, first_lost, cc.cwnd);
+            }
+        }
+
+        // Resend the unreported segments when the oldest one has seen no progress for too long
+        if (base != next && now_us() >= deadline) {
+            if (++retransmissions > MAX_RETRANSMISSIONS) {
+                LOG_WARN("File transfer timed out: no acknowledgment for segment %u", base);
+                handle_transition(ERROR);
+                break;
+            }
+            cc_on_timeout(&cc, now_us());
+            recovery_end = next;
+            LOG_DEBUG("Retransmitting missing segments from %u to %u (cwnd %.1f, timeout %" PRIu64 " us)", base, next - 1, cc.cwnd, cc_retransmit_timeout(&cc, retransmissions));
+            send_missing_segments(sockfd, servaddr, len, &window, acked, base, next);
+            deadline = now_us() + cc_retransmit_timeout(&cc, retransmissions);
+        }
+    }
+    LOG_INFO("Congestion control %s: cwnd %.1f segments, pacing %.2f MB/s, srtt %" PRIu64 " us, min RTT %" PRIu64 " us",
+             cc_algorithm_name(cc.algorithm), cc.cwnd, cc.pacing_rate * segment_size / 1e6, cc.srtt_us, cc.min_rtt_us);
+    if (base == total_segments) {
+        hash_file_range(&file_hash, window.data, &hashed, file_size);
+    }
+    free(covered);
+    free(window.compressed);
+    free(acked);
+    free(window.transmissions);
+    free(window.sent_at);
+    free(window.headers);
+    if (map != NULL) {
+        munmap(map, map_skip + file_size);
+    }
+    if (base != total_segments) {
+        return -1;
     }
 
     // Send file transfer complete message
     CP_FileTransferComplete complete;
-    encode_file_transfer_complete(&complete, file_id);
+    encode_file_transfer_complete(&complete, file_id, xxh64_final(&file_hash));
     sendto(sockfd, &complete, sizeof(complete), MSG_CONFIRM, (const struct sockaddr *)servaddr, len);
 
-    printf("File transfer complete: ID %u\n", file_id);
+    LOG_INFO("File transfer complete: ID %u (XXH64 %016" PRIx64 ")", file_id, complete.file_hash);
+    return 0;
 }
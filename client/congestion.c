@@ -0,0 +1,305 @@
+#include "congestion.h"
+#include <math.h>
+#include <string.h>
+#include <strings.h>
+
+#define CC_INITIAL_WINDOW 10
+#define CC_MIN_WINDOW 2
+
+// Retransmission timeout (RFC 6298, with bounds suited to LAN round trips): the timeout before the
+// first RTT sample, the clock granularity added to it, and its floor and ceiling
+#define CC_INITIAL_RTO_US 200000
+#define CC_RTO_GRANULARITY_US 1000
+#define CC_MIN_RTO_US 20000
+#define CC_MAX_RTO_US 4000000
+
+// CUBIC (RFC 9438): window scaling constant and multiplicative decrease factor
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+// Pacing gain over cwnd/srtt, high in slow start so the window can still double every round
+#define CUBIC_SLOW_START_GAIN 2.0
+#define CUBIC_AVOIDANCE_GAIN 1.2
+
+// BBR: startup gain 2/ln(2), a window of twice the BDP, and the probe cycle of one round above
+// the estimate, one below to drain what it queued, and six at it
+#define BBR_STARTUP 0
+#define BBR_DRAIN 1
+#define BBR_PROBE_BW 2
+#define BBR_HIGH_GAIN 2.885
+#define BBR_CWND_GAIN 2.0
+#define BBR_FULL_BW_GROWTH 1.25
+#define BBR_FULL_BW_ROUNDS 3
+#define BBR_CYCLE_LENGTH 8
+// Minimum round duration, so an RTT measured below the timer resolution does not produce rounds
+// too short to deliver anything
+#define BBR_MIN_ROUND_US 1000
+// The minimum RTT is re-measured from scratch after this long
+#define BBR_MIN_RTT_WINDOW_US 10000000ULL
+
+static const double bbr_pacing_cycle[BBR_CYCLE_LENGTH] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+
+static const char *const algorithm_names[] = {
+    [CC_NONE] = "none",
+    [CC_CUBIC] = "cubic",
+    [CC_BBR] = "bbr",
+};
+
+#define ALGORITHM_COUNT (sizeof(algorithm_names) / sizeof(algorithm_names[0]))
+
+// Function to look up an algorithm by its configuration name
+CongestionAlgorithm cc_algorithm_from_string(const char *name, CongestionAlgorithm default_algorithm) {
+    if (name == NULL) {
+        return default_algorithm;
+    }
+    for (size_t i = 0; i < ALGORITHM_COUNT; i++) {
+        if (strcasecmp(name, algorithm_names[i]) == 0) {
+            return (CongestionAlgorithm)i;
+        }
+    }
+    return default_algorithm;
+}
+
+const char *cc_algorithm_name(CongestionAlgorithm algorithm) {
+    return algorithm < ALGORITHM_COUNT ? algorithm_names[algorithm] : "unknown";
+}
+
+// Function to start a transfer: the initial window, unpaced until the first RTT sample.
+// max_window is the number of segments the sender can track in flight.
+void cc_init(CongestionControl *cc, CongestionAlgorithm algorithm, uint32_t max_window) {
+    memset(cc, 0, sizeof(*cc));
+    cc->algorithm = algorithm;
+    cc->max_cwnd = max_window;
+    cc->cwnd = algorithm == CC_NONE || max_window < CC_INITIAL_WINDOW ? max_window : CC_INITIAL_WINDOW;
+    cc->ssthresh = max_window;
+    cc->mode = BBR_STARTUP;
+    cc->pacing_gain = BBR_HIGH_GAIN;
+}
+
+// Function to round the window down to whole segments
+uint32_t cc_window(const CongestionControl *cc) {
+    return cc->cwnd < CC_MIN_WINDOW ? CC_MIN_WINDOW : (uint32_t)cc->cwnd;
+}
+
+// Function to tell how many segments may be sent now: a burst of up to burst segments once the
+// pacing timer has expired, nothing before, and no limit while unpaced
+uint32_t cc_pacing_budget(const CongestionControl *cc, uint64_t now_us, uint32_t burst) {
+    if (cc->pacing_rate <= 0) {
+        return UINT32_MAX;
+    }
+    return now_us >= cc->next_send_us ? burst : 0;
+}
+
+// Function to advance the pacing timer by the time segments take to leave at the pacing rate.
+// Time spent idle is not banked, so the sender never catches up with a line-rate burst.
+void cc_on_send(CongestionControl *cc, uint32_t segments, uint64_t now_us) {
+    if (cc->pacing_rate <= 0) {
+        return;
+    }
+    if (cc->next_send_us < now_us) {
+        cc->next_send_us = now_us;
+    }
+    cc->next_send_us += (uint64_t)(segments * 1e6 / cc->pacing_rate);
+}
+
+static double clamp_window(const CongestionControl *cc, double cwnd) {
+    if (cwnd < CC_MIN_WINDOW) {
+        return CC_MIN_WINDOW;
+    }
+    return cwnd > cc->max_cwnd ? cc->max_cwnd : cwnd;
+}
+
+// Function to fold an RTT sample into the smoothed RTT, its variation (RFC 6298) and the minimum RTT
+static void update_rtt(CongestionControl *cc, uint64_t rtt_us, uint64_t now_us) {
+    if (rtt_us == 0) {
+        return;
+    }
+    if (cc->srtt_us == 0) {
+        cc->srtt_us = rtt_us;
+        cc->rttvar_us = rtt_us / 2;
+    } else {
+        uint64_t deviation = cc->srtt_us > rtt_us ? cc->srtt_us - rtt_us : rtt_us - cc->srtt_us;
+        cc->rttvar_us = (3 * cc->rttvar_us + deviation) / 4;
+        cc->srtt_us = (7 * cc->srtt_us + rtt_us) / 8;
+    }
+    if (cc->min_rtt_us == 0 || rtt_us <= cc->min_rtt_us || now_us - cc->min_rtt_stamp_us > BBR_MIN_RTT_WINDOW_US) {
+        cc->min_rtt_us = rtt_us;
+        cc->min_rtt_stamp_us = now_us;
+    }
+}
+
+// Function to grow the CUBIC window: exponentially in slow start, then along the cubic curve
+// through w_max, never slower than Reno would grow over the same time
+static void cubic_on_ack(CongestionControl *cc, uint32_t acked, uint64_t now_us) {
+    if (cc->cwnd < cc->ssthresh) {
+        cc->cwnd += acked;
+    } else {
+        if (cc->epoch_start_us == 0) {
+            cc->epoch_start_us = now_us;
+            if (cc->w_max < cc->cwnd) {
+                cc->w_max = cc->cwnd;
+            }
+            cc->k = cbrt((cc->w_max - cc->cwnd) / CUBIC_C);
+        }
+        double t = (now_us - cc->epoch_start_us) / 1e6;
+        double target = cc->w_max + CUBIC_C * (t - cc->k) * (t - cc->k) * (t - cc->k);
+        if (target > cc->cwnd) {
+            cc->cwnd += (target - cc->cwnd) * acked / cc->cwnd;
+        } else {
+            cc->cwnd += 0.01 * acked / cc->cwnd;
+        }
+
+        if (cc->srtt_us > 0) {
+            double reno = cc->w_max * CUBIC_BETA + 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * t * 1e6 / cc->srtt_us;
+            if (reno > cc->cwnd) {
+                cc->cwnd = reno;
+            }
+        }
+    }
+    cc->cwnd = clamp_window(cc, cc->cwnd);
+
+    if (cc->srtt_us > 0) {
+        double gain = cc->cwnd < cc->ssthresh ? CUBIC_SLOW_START_GAIN : CUBIC_AVOIDANCE_GAIN;
+        cc->pacing_rate = gain * cc->cwnd * 1e6 / cc->srtt_us;
+    }
+}
+
+// Function to close a BBR round once a minimum RTT has passed: record its delivery rate, update
+// the bandwidth estimate and move through startup, drain and the probe cycle
+static void bbr_end_round(CongestionControl *cc, uint64_t now_us) {
+    double rate = cc->round_delivered * 1e6 / (now_us - cc->round_start_us);
+    cc->bw_rounds[cc->round % BBR_BW_ROUNDS] = rate;
+    cc->round++;
+    cc->round_start_us = now_us;
+    cc->round_delivered = 0;
+    cc->ack_burst[1] = cc->ack_burst[0];
+    cc->ack_burst[0] = 0;
+
+    cc->bw = 0;
+    for (int i = 0; i < BBR_BW_ROUNDS; i++) {
+        if (cc->bw_rounds[i] > cc->bw) {
+            cc->bw = cc->bw_rounds[i];
+        }
+    }
+
+    switch (cc->mode) {
+        case BBR_STARTUP:
+            // The pipe is full once three rounds in a row failed to grow the bandwidth by a quarter
+            if (cc->bw >= cc->full_bw * BBR_FULL_BW_GROWTH) {
+                cc->full_bw = cc->bw;
+                cc->full_bw_rounds = 0;
+            } else if (++cc->full_bw_rounds >= BBR_FULL_BW_ROUNDS) {
+                cc->mode = BBR_DRAIN;
+                cc->pacing_gain = 1 / BBR_HIGH_GAIN;
+            }
+            break;
+        case BBR_DRAIN:
+            cc->mode = BBR_PROBE_BW;
+            cc->pacing_gain = bbr_pacing_cycle[cc->round % BBR_CYCLE_LENGTH];
+            break;
+        default:
+            cc->pacing_gain = bbr_pacing_cycle[cc->round % BBR_CYCLE_LENGTH];
+            break;
+    }
+}
+
+// Function to update the BBR model: the window follows the measured BDP, except in startup
+// where it grows like slow start until the first bandwidth estimate exceeds it. The receiver
+// acknowledges in batches, so the window also holds the largest batch recently acknowledged,
+// or the sender would sit idle between acknowledgments on a short path.
+static void bbr_on_ack(CongestionControl *cc, uint32_t acked, uint64_t now_us) {
+    if (cc->round_start_us == 0) {
+        cc->round_start_us = now_us;
+    }
+    cc->round_delivered += acked;
+    if (acked > cc->ack_burst[0]) {
+        cc->ack_burst[0] = acked;
+    }
+    uint64_t round_length = cc->min_rtt_us > BBR_MIN_ROUND_US ? cc->min_rtt_us : BBR_MIN_ROUND_US;
+    if (now_us - cc->round_start_us >= round_length) {
+        bbr_end_round(cc, now_us);
+    }
+
+    double bdp = cc->bw * cc->min_rtt_us / 1e6;
+    uint32_t ack_burst = cc->ack_burst[0] > cc->ack_burst[1] ? cc->ack_burst[0] : cc->ack_burst[1];
+    if (cc->mode == BBR_STARTUP) {
+        cc->cwnd += acked;
+        if (cc->bw > 0 && cc->cwnd > BBR_HIGH_GAIN * bdp && BBR_HIGH_GAIN * bdp >= CC_INITIAL_WINDOW) {
+            cc->cwnd = BBR_HIGH_GAIN * bdp;
+        }
+    } else {
+        cc->cwnd = BBR_CWND_GAIN * bdp + ack_burst;
+    }
+    cc->cwnd = clamp_window(cc, cc->cwnd);
+
+    if (cc->bw > 0) {
+        cc->pacing_rate = cc->pacing_gain * cc->bw;
+    } else if (cc->srtt_us > 0) {
+        cc->pacing_rate = cc->pacing_gain * cc->cwnd * 1e6 / cc->srtt_us;
+    }
+}
+
+// Function to account for acked segments newly acknowledged, with an RTT sample in rtt_us
+// (0 when every one of them was retransmitted and the sample would be ambiguous)
+void cc_on_ack(CongestionControl *cc, uint32_t acked, uint64_t rtt_us, uint64_t now_us) {
+    update_rtt(cc, rtt_us, now_us);
+    if (acked == 0) {
+        return;
+    }
+    switch (cc->algorithm) {
+        case CC_CUBIC:
+            cubic_on_ack(cc, acked, now_us);
+            break;
+        case CC_BBR:
+            bbr_on_ack(cc, acked, now_us);
+            break;
+        default:
+            break;
+    }
+}
+
+// Function to react to a loss detected while acknowledgments keep arriving. CUBIC backs off by
+// beta, remembering a lower w_max when losses come before it regained the last one; BBR treats
+// loss as noise and relies on its model.
+void cc_on_loss(CongestionControl *cc, uint64_t now_us) {
+    (void)now_us;
+    if (cc->algorithm != CC_CUBIC) {
+        return;
+    }
+    cc->w_max = cc->cwnd < cc->w_max ? cc->cwnd * (1 + CUBIC_BETA) / 2 : cc->cwnd;
+    cc->ssthresh = clamp_window(cc, cc->cwnd * CUBIC_BETA);
+    cc->cwnd = cc->ssthresh;
+    cc->epoch_start_us = 0;
+}
+
+// Function to react to a retransmission timeout: the path may have changed entirely, so both
+// algorithms restart from the minimum window (CUBIC then slow starts back up to ssthresh)
+void cc_on_timeout(CongestionControl *cc, uint64_t now_us) {
+    switch (cc->algorithm) {
+        case CC_CUBIC:
+            cc_on_loss(cc, now_us);
+            cc->cwnd = CC_MIN_WINDOW;
+            break;
+        case CC_BBR:
+            cc->cwnd = CC_MIN_WINDOW;
+            break;
+        default:
+            break;
+    }
+}
+
+// Function to compute the retransmission timeout in microseconds: SRTT + 4 * RTTVAR, doubled for
+// each of backoff timeouts in a row and kept between CC_MIN_RTO_US and CC_MAX_RTO_US
+uint64_t cc_retransmit_timeout(const CongestionControl *cc, int backoff) {
+    uint64_t rto = CC_INITIAL_RTO_US;
+    if (cc->srtt_us > 0) {
+        uint64_t variation = 4 * cc->rttvar_us > CC_RTO_GRANULARITY_US ? 4 * cc->rttvar_us : CC_RTO_GRANULARITY_US;
+        rto = cc->srtt_us + variation;
+    }
+    if (rto < CC_MIN_RTO_US) {
+        rto = CC_MIN_RTO_US;
+    }
+    for (int i = 0; i < backoff && rto < CC_MAX_RTO_US; i++) {
+        rto *= 2;
+    }
+    return rto > CC_MAX_RTO_US ? CC_MAX_RTO_US : rto;
+}
@@ -0,0 +1,57 @@
+#ifndef CONGESTION_H
+#define CONGESTION_H
+
+#include <stdint.h>
+
+// Congestion control algorithms for the file sender
+typedef enum {
+    CC_NONE, // Fixed window of window_segments, unpaced
+    CC_CUBIC, // Loss-based: slow start, then a cubic function of the time since the last loss
+    CC_BBR // Model-based: paces at the measured bottleneck bandwidth, window of twice the BDP
+} CongestionAlgorithm;
+
+// Number of rounds the bottleneck bandwidth estimate remembers its maximum over
+#define BBR_BW_ROUNDS 10
+
+// Sender state of one transfer. Windows count segments; times are in microseconds of the
+// monotonic clock and rates in segments per second.
+typedef struct {
+    CongestionAlgorithm algorithm;
+    double cwnd; // Segments allowed in flight
+    double max_cwnd; // The sender's window; cwnd never grows beyond it
+    double ssthresh; // Slow start ends once cwnd reaches it
+    double pacing_rate; // 0 until the first RTT sample, and always for CC_NONE: send unpaced
+    uint64_t next_send_us; // Pacing releases the next burst at this time
+    uint64_t srtt_us; // Smoothed round-trip time, 0 before the first sample
+    uint64_t rttvar_us; // Mean deviation of the RTT samples
+    uint64_t min_rtt_us;
+    uint64_t min_rtt_stamp_us; // When min_rtt_us was measured
+    // CUBIC
+    double w_max; // Window before the last reduction
+    double k; // Seconds the cubic function takes to climb back to w_max
+    uint64_t epoch_start_us; // Start of the current growth epoch, 0 after a reduction
+    // BBR
+    int mode; // BBR_STARTUP, BBR_DRAIN or BBR_PROBE_BW
+    double bw_rounds[BBR_BW_ROUNDS]; // Delivery rate measured in each recent round
+    double bw; // Bottleneck bandwidth estimate: the maximum of bw_rounds
+    double full_bw; // Bandwidth startup last grew to by at least a quarter
+    int full_bw_rounds; // Rounds since then
+    uint32_t round; // Round-trip counter
+    uint64_t round_start_us;
+    uint32_t round_delivered; // Segments acknowledged in the current round
+    uint32_t ack_burst[2]; // Most segments one acknowledgment covered, this round and the last
+    double pacing_gain;
+} CongestionControl;
+
+CongestionAlgorithm cc_algorithm_from_string(const char *name, CongestionAlgorithm default_algorithm);
+const char *cc_algorithm_name(CongestionAlgorithm algorithm);
+void cc_init(CongestionControl *cc, CongestionAlgorithm algorithm, uint32_t max_window);
+uint32_t cc_window(const CongestionControl *cc);
+uint32_t cc_pacing_budget(const CongestionControl *cc, uint64_t now_us, uint32_t burst);
+void cc_on_send(CongestionControl *cc, uint32_t segments, uint64_t now_us);
+void cc_on_ack(CongestionControl *cc, uint32_t acked, uint64_t rtt_us, uint64_t now_us);
+void cc_on_loss(CongestionControl *cc, uint64_t now_us);
+void cc_on_timeout(CongestionControl *cc, uint64_t now_us);
+uint64_t cc_retransmit_timeout(const CongestionControl *cc, int backoff);
+
+#endif // CONGESTION_H
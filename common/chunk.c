@@ -0,0 +1,51 @@
+#include "chunk.h"
+#include <pthread.h>
+
+// FastCDC cut-point masks for an 8 KiB average: harder to match before the average size and
+// easier after it, which narrows the spread of chunk sizes
+#define CHUNK_MASK_SMALL 0x0003590703530000ULL
+#define CHUNK_MASK_LARGE 0x0000d90003530000ULL
+
+// Gear hash table: one random 64-bit value per byte value
+static uint64_t chunk_gear[256];
+static pthread_once_t chunk_gear_once = PTHREAD_ONCE_INIT;
+
+// Function to fill the gear table from a fixed splitmix64 sequence, so every build cuts the same
+// content at the same places
+static void chunk_gear_init(void) {
+    uint64_t seed = 0x43505f4348554e4bULL;
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        chunk_gear[i] = z ^ (z >> 31);
+    }
+}
+
+// Function to find the length of the next chunk at the start of data with a gear rolling hash.
+// Boundaries depend only on nearby content, so an insertion early in a file shifts at most the
+// chunks around it and the rest still match. Safe to call from several threads at once.
+size_t chunk_next(const uint8_t *data, size_t size) {
+    pthread_once(&chunk_gear_once, chunk_gear_init);
+    if (size <= CHUNK_MIN_SIZE) {
+        return size;
+    }
+    size_t normal = size < CHUNK_AVG_SIZE ? size : CHUNK_AVG_SIZE;
+    size_t limit = size < CHUNK_MAX_SIZE ? size : CHUNK_MAX_SIZE;
+
+    uint64_t hash = 0;
+    size_t i = CHUNK_MIN_SIZE;
+    for (; i < normal; i++) {
+        hash = (hash << 1) + chunk_gear[data[i]];
+        if (!(hash & CHUNK_MASK_SMALL)) {
+            return i + 1;
+        }
+    }
+    for (; i < limit; i++) {
+        hash = (hash << 1) + chunk_gear[data[i]];
+        if (!(hash & CHUNK_MASK_LARGE)) {
+            return i + 1;
+        }
+    }
+    return limit;
+}
@@ -0,0 +1,15 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Content-defined chunk sizes: no cut before the minimum, cuts aimed at the average, and a forced
+// cut at the maximum. Every client must use the same parameters for chunks to deduplicate.
+#define CHUNK_MIN_SIZE 2048
+#define CHUNK_AVG_SIZE 8192
+#define CHUNK_MAX_SIZE 65536
+
+size_t chunk_next(const uint8_t *data, size_t size);
+
+#endif // CHUNK_H
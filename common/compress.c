@@ -0,0 +1,264 @@
+#include "compress.h"
+#include "message.h"
+#include <string.h>
+
+// LZ codec in the LZ4 block format: sequences of a token (literal and match length nibbles),
+// the literals, a 16-bit little-endian offset and length continuations in runs of 255.
+// The last 5 bytes are always literals and no match starts within 12 bytes of the end.
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_LIMIT 12
+#define LZ_MAX_OFFSET 65535
+// Misses after which the match search starts skipping ahead faster through incompressible input
+#define LZ_SKIP_TRIGGER 6
+
+// Entropy probe: sampled runs of bytes and the smallest input worth compressing
+#define PROBE_RUNS 64
+#define PROBE_RUN_LENGTH 16
+#define PROBE_MIN_SIZE 32
+
+typedef struct {
+    const char *name;
+    size_t (*compress)(const char *src, size_t size, char *dst, size_t capacity);
+    int (*decompress)(const char *src, size_t size, char *dst, size_t capacity);
+} Codec;
+
+static uint32_t lz_read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t lz_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Function to append the continuation bytes of a length that did not fit its token nibble
+static uint8_t *lz_write_length(uint8_t *op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+// Function to append one sequence (literals followed by a match, or only literals when
+// match_length is 0); returns NULL if it does not fit before oend
+static uint8_t *lz_write_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *literals, size_t literal_length, uint16_t offset, size_t match_length) {
+    size_t needed = 1 + literal_length + literal_length / 255 + 1;
+    if (match_length > 0) {
+        needed += 2 + (match_length - LZ_MIN_MATCH) / 255 + 1;
+    }
+    if (needed > (size_t)(oend - op)) {
+        return NULL;
+    }
+
+    uint8_t *token = op++;
+    *token = (literal_length >= 15 ? 15 : literal_length) << 4;
+    if (literal_length >= 15) {
+        op = lz_write_length(op, literal_length - 15);
+    }
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+    if (match_length == 0) {
+        return op;
+    }
+
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    size_t extra = match_length - LZ_MIN_MATCH;
+    *token |= extra >= 15 ? 15 : extra;
+    if (extra >= 15) {
+        op = lz_write_length(op, extra - 15);
+    }
+    return op;
+}
+
+// Function to compress with a single-entry hash table of 4-byte sequences (greedy matching);
+// returns the compressed size, or 0 if it would exceed capacity
+static size_t lz_compress(const char *src, size_t size, char *dst, size_t capacity) {
+    const uint8_t *base = (const uint8_t *)src;
+    const uint8_t *end = base + size;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;
+    uint8_t *op = (uint8_t *)dst;
+    const uint8_t *oend = op + capacity;
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    if (size > LZ_MATCH_LIMIT) {
+        const uint8_t *match_limit = end - LZ_MATCH_LIMIT;
+        uint32_t misses = 0;
+        while (ip < match_limit) {
+            uint32_t sequence = lz_read32(ip);
+            uint32_t hash = lz_hash(sequence);
+            const uint8_t *ref = base + table[hash];
+            table[hash] = ip - base;
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != sequence) {
+                ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+
+            // Grow the match backwards over pending literals, then forwards up to the literal tail
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            size_t length = LZ_MIN_MATCH;
+            while (ip + length < end - LZ_LAST_LITERALS && ip[length] == ref[length]) {
+                length++;
+            }
+
+            op = lz_write_sequence(op, oend, anchor, ip - anchor, ip - ref, length);
+            if (op == NULL) {
+                return 0;
+            }
+            ip += length;
+            anchor = ip;
+            if (ip < match_limit) {
+                table[lz_hash(lz_read32(ip - 2))] = ip - 2 - base;
+            }
+        }
+    }
+
+    op = lz_write_sequence(op, oend, anchor, end - anchor, 0, 0);
+    return op == NULL ? 0 : op - (uint8_t *)dst;
+}
+
+// Function to read the continuation bytes of a length; returns -1 if the input ends first
+static int lz_read_length(const uint8_t **ip, const uint8_t *iend, size_t *length) {
+    uint8_t byte;
+    do {
+        if (*ip >= iend) {
+            return -1;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+// Function to decompress, checking every length and offset against both buffers; returns the
+// decompressed size, or -1 if the input is malformed or would overflow capacity
+static int lz_decompress(const char *src, size_t size, char *dst, size_t capacity) {
+    const uint8_t *ip = (const uint8_t *)src;
+    const uint8_t *iend = ip + size;
+    uint8_t *op = (uint8_t *)dst;
+    uint8_t *oend = op + capacity;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && lz_read_length(&ip, iend, &literal_length) < 0) {
+            return -1;
+        }
+        if (literal_length > (size_t)(iend - ip) || literal_length > (size_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, literal_length);
+        op += literal_length;
+        ip += literal_length;
+        if (ip == iend) {
+            break; // The last sequence carries only literals
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t match_length = token & 15;
+        if (match_length == 15 && lz_read_length(&ip, iend, &match_length) < 0) {
+            return -1;
+        }
+        match_length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst) || match_length > (size_t)(oend - op)) {
+            return -1;
+        }
+
+        // A match may overlap the bytes it produces, repeating a short pattern
+        const uint8_t *ref = op - offset;
+        if (offset >= match_length) {
+            memcpy(op, ref, match_length);
+        } else {
+            for (size_t i = 0; i < match_length; i++) {
+                op[i] = ref[i];
+            }
+        }
+        op += match_length;
+    }
+    return op - (uint8_t *)dst;
+}
+
+static const Codec codecs[] = {
+    [CP_CODEC_LZ] = {"lz", lz_compress, lz_decompress},
+};
+
+#define CODEC_COUNT (sizeof(codecs) / sizeof(codecs[0]))
+
+static const Codec *codec_lookup(uint8_t codec) {
+    if (codec >= CODEC_COUNT || codecs[codec].compress == NULL) {
+        return NULL;
+    }
+    return &codecs[codec];
+}
+
+// Function to list the codecs this build implements, as a bitmask of 1 << CP_CODEC_*
+uint8_t codec_supported(void) {
+    uint8_t mask = 0;
+    for (uint8_t codec = 0; codec < CODEC_COUNT; codec++) {
+        if (codec_lookup(codec) != NULL) {
+            mask |= 1 << codec;
+        }
+    }
+    return mask;
+}
+
+const char *codec_name(uint8_t codec) {
+    const Codec *entry = codec_lookup(codec);
+    return entry != NULL ? entry->name : "none";
+}
+
+// Function to compress size bytes of src into dst; returns the compressed size, or 0 if the codec
+// is unknown or the result does not fit in capacity. Pass a capacity below size to insist on a gain.
+size_t codec_compress(uint8_t codec, const char *src, size_t size, char *dst, size_t capacity) {
+    const Codec *entry = codec_lookup(codec);
+    return entry != NULL ? entry->compress(src, size, dst, capacity) : 0;
+}
+
+// Function to decompress size bytes of src into dst; returns the decompressed size, or -1 if the
+// codec is unknown, the data is malformed or the output exceeds capacity
+int codec_decompress(uint8_t codec, const char *src, size_t size, char *dst, size_t capacity) {
+    const Codec *entry = codec_lookup(codec);
+    return entry != NULL ? entry->decompress(src, size, dst, capacity) : -1;
+}
+
+// Function to guess from a sample whether data is worth compressing. Runs of bytes spread over the
+// buffer are counted into a histogram; data whose sampled bytes collide less often than 1 in 181
+// (a collision entropy above 7.5 bits per byte) is taken to be compressed or encrypted already.
+int codec_worthwhile(const char *data, size_t size) {
+    if (size < PROBE_MIN_SIZE) {
+        return 0;
+    }
+    uint32_t counts[256];
+    memset(counts, 0, sizeof(counts));
+    size_t samples = 0;
+    size_t runs = size / PROBE_RUN_LENGTH < PROBE_RUNS ? size / PROBE_RUN_LENGTH : PROBE_RUNS;
+    size_t stride = size / runs;
+    for (size_t run = 0; run < runs; run++) {
+        const uint8_t *p = (const uint8_t *)data + run * stride;
+        for (int i = 0; i < PROBE_RUN_LENGTH; i++) {
+            counts[p[i]]++;
+        }
+        samples += PROBE_RUN_LENGTH;
+    }
+
+    uint64_t collisions = 0;
+    for (int i = 0; i < 256; i++) {
+        collisions += (uint64_t)counts[i] * (counts[i] - 1);
+    }
+    return collisions * 181 > (uint64_t)samples * (samples - 1);
+}
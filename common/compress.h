@@ -0,0 +1,16 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Wire codecs, identified by the CP_CODEC_* number carried in the header flags of a message
+// whose payload they encoded. Each codec is a pair of functions in a table, so adding one only
+// takes a new entry there and a new number.
+uint8_t codec_supported(void);
+const char *codec_name(uint8_t codec);
+size_t codec_compress(uint8_t codec, const char *src, size_t size, char *dst, size_t capacity);
+int codec_decompress(uint8_t codec, const char *src, size_t size, char *dst, size_t capacity);
+int codec_worthwhile(const char *data, size_t size);
+
+#endif // COMPRESS_H
@@ -0,0 +1,173 @@
+#include "crc32c.h"
+#include <pthread.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+// Reflected Castagnoli polynomial
+#define CRC32C_POLY 0x82f63b78
+
+// Slicing-by-8 tables for the portable path: table[k][b] is the CRC of byte b followed by k zeros
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_table_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_table_init(void) {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int i = 0; i < 8; i++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t prev = crc32c_table[k - 1][b];
+            crc32c_table[k][b] = (prev >> 8) ^ crc32c_table[0][prev & 0xff];
+        }
+    }
+}
+
+// Function to update a (pre-inverted) CRC eight bytes at a time with table lookups
+static uint32_t crc32c_portable(uint32_t crc, const uint8_t *p, size_t size) {
+    pthread_once(&crc32c_table_once, crc32c_table_init);
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        word ^= crc; // Little-endian: the CRC lines up with the first four bytes
+        crc = crc32c_table[7][word & 0xff] ^ crc32c_table[6][(word >> 8) & 0xff] ^
+              crc32c_table[5][(word >> 16) & 0xff] ^ crc32c_table[4][(word >> 24) & 0xff] ^
+              crc32c_table[3][(word >> 32) & 0xff] ^ crc32c_table[2][(word >> 40) & 0xff] ^
+              crc32c_table[1][(word >> 48) & 0xff] ^ crc32c_table[0][word >> 56];
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+// Bytes per lane of the interleaved hardware loop. The crc32 instruction has a latency of three
+// cycles but issues every cycle, so three independent lanes run about three times as fast as one.
+#define CRC32C_LANE 4096
+
+// Shifts a CRC register over CRC32C_LANE zero bytes, one table per byte of the register. The
+// lanes are combined with it: crc(A B C) = shift(shift(crc(A)) ^ crc(B)) ^ crc(C), where B and C
+// start from 0. A table lookup does what PCLMUL folding would, independently of the CPU.
+static uint32_t crc32c_shift_table[4][256];
+static pthread_once_t crc32c_shift_once = PTHREAD_ONCE_INIT;
+
+// Function to update a (pre-inverted) CRC with the SSE4.2 crc32 instruction, eight bytes per step
+__attribute__((target("sse4.2"))) static uint32_t crc32c_serial(uint32_t crc, const uint8_t *p, size_t size) {
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        size -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (size-- > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+// Function to build the shift tables: shifting is linear, so each entry is the XOR of the shifted
+// register bits it contains
+static void crc32c_shift_init(void) {
+    static const uint8_t zeros[CRC32C_LANE];
+    uint32_t shifted_bit[32];
+    for (int bit = 0; bit < 32; bit++) {
+        shifted_bit[bit] = crc32c_serial((uint32_t)1 << bit, zeros, sizeof(zeros));
+    }
+    for (int k = 0; k < 4; k++) {
+        for (uint32_t b = 0; b < 256; b++) {
+            uint32_t value = 0;
+            for (int i = 0; i < 8; i++) {
+                if ((b >> i) & 1) {
+                    value ^= shifted_bit[8 * k + i];
+                }
+            }
+            crc32c_shift_table[k][b] = value;
+        }
+    }
+}
+
+static uint32_t crc32c_shift(uint32_t crc) {
+    return crc32c_shift_table[0][crc & 0xff] ^ crc32c_shift_table[1][(crc >> 8) & 0xff] ^
+           crc32c_shift_table[2][(crc >> 16) & 0xff] ^ crc32c_shift_table[3][crc >> 24];
+}
+
+// Function to update a (pre-inverted) CRC with the SSE4.2 crc32 instruction, over three lanes at a
+// time while the data lasts
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hardware(uint32_t crc, const uint8_t *p, size_t size) {
+    if (size >= 3 * CRC32C_LANE) {
+        pthread_once(&crc32c_shift_once, crc32c_shift_init);
+    }
+    while (size >= 3 * CRC32C_LANE) {
+        uint64_t a = crc, b = 0, c = 0;
+        for (size_t i = 0; i < CRC32C_LANE; i += 8) {
+            uint64_t wa, wb, wc;
+            memcpy(&wa, p + i, sizeof(wa));
+            memcpy(&wb, p + CRC32C_LANE + i, sizeof(wb));
+            memcpy(&wc, p + 2 * CRC32C_LANE + i, sizeof(wc));
+            a = _mm_crc32_u64(a, wa);
+            b = _mm_crc32_u64(b, wb);
+            c = _mm_crc32_u64(c, wc);
+        }
+        crc = crc32c_shift(crc32c_shift((uint32_t)a) ^ (uint32_t)b) ^ (uint32_t)c;
+        p += 3 * CRC32C_LANE;
+        size -= 3 * CRC32C_LANE;
+    }
+    return crc32c_serial(crc, p, size);
+}
+
+static int crc32c_hardware_supported(void) {
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+// Function to update a (pre-inverted) CRC with the ARMv8 crc32c instructions, eight bytes per step
+static uint32_t crc32c_hardware(uint32_t crc, const uint8_t *p, size_t size) {
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc = __crc32cd(crc, word);
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+
+static int crc32c_hardware_supported(void) {
+    return 1;
+}
+#else
+static uint32_t crc32c_hardware(uint32_t crc, const uint8_t *p, size_t size) {
+    return crc32c_portable(crc, p, size);
+}
+
+static int crc32c_hardware_supported(void) {
+    return 0;
+}
+#endif
+
+// Function to compute the CRC-32C of size bytes, continuing from crc. The CPU check runs once;
+// threads racing on the first call all store the same answer.
+uint32_t crc32c(uint32_t crc, const void *data, size_t size) {
+    static int hardware = -1;
+    if (hardware < 0) {
+        hardware = crc32c_hardware_supported();
+    }
+    crc = ~crc;
+    crc = hardware ? crc32c_hardware(crc, data, size) : crc32c_portable(crc, data, size);
+    return ~crc;
+}
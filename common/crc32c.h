@@ -0,0 +1,11 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (Castagnoli), as used by iSCSI and ext4. Pass 0 to start and the previous result to
+// continue over more data. Uses the SSE4.2 or ARMv8 CRC instructions when the CPU has them.
+uint32_t crc32c(uint32_t crc, const void *data, size_t size);
+
+#endif // CRC32C_H
@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+#include "log.h"
+#include "ring.h"
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Records buffered per logging thread before new ones are dropped
+#define LOG_RING_DEPTH 1024
+// Interval at which the flusher drains the rings when nobody asks for a flush
+#define LOG_FLUSH_INTERVAL_MS 50
+// Numeric and string arguments a single record can carry
+#define LOG_MAX_ARGS 8
+#define LOG_TEXT_SIZE 96
+// Longest formatted line; longer messages are truncated
+#define LOG_LINE_SIZE 1024
+// LogSpec.precision value for a precision passed as an argument
+#define LOG_PRECISION_ARG -2
+
+// Binary log record: the caller only captures raw argument values, the flusher formats them
+typedef struct {
+    struct timespec time; // Wall-clock time the message was logged
+    const char *fmt; // String literal from the call site
+    uint8_t level;
+    uint8_t argc;
+    uint16_t text_len;
+    uint64_t args[LOG_MAX_ARGS]; // Integer, double or pointer bits, or an offset into text for %s
+    char text[LOG_TEXT_SIZE]; // Copies of the string arguments, each NUL-terminated
+} LogRecord;
+
+// Ring owned by one logging thread; the flusher is its only consumer
+typedef struct LogThread {
+    SpscRing ring;
+    uint64_t reported_dropped; // Overflow already reported by the flusher
+    struct LogThread *next;
+} LogThread;
+
+LogLevel log_level = LOG_LEVEL_INFO;
+uint32_t log_sample = 1;
+
+static const char *const level_names[] = {"ERROR", "WARN", "INFO", "DEBUG"};
+
+static _Thread_local LogThread *log_self; // Calling thread's ring, registered on first use
+static _Thread_local int log_unavailable; // Ring allocation failed; drop this thread's records
+
+static LogThread *log_threads; // Registered rings, newest first; nodes are never removed
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_wake = PTHREAD_COND_INITIALIZER; // Signals the flusher
+static pthread_cond_t log_done = PTHREAD_COND_INITIALIZER; // Signals waiters in log_flush
+static pthread_t log_flusher;
+static int log_running;
+static int log_stopping;
+static uint64_t log_flush_requested;
+static uint64_t log_flush_completed;
+
+// Conversion specification parsed from a printf format
+typedef struct {
+    const char *start; // The '%'
+    const char *end; // One past the conversion character
+    char length[3]; // Length modifier: "", "hh", "h", "l", "ll", "j", "z", "t" or "L"
+    char conversion;
+    int stars; // Width and precision taken from int arguments ('*')
+    int precision; // -1 if absent, LOG_PRECISION_ARG if given by an argument
+} LogSpec;
+
+// Function to parse the conversion starting at percent; returns 0 if the format ends inside it
+static int log_parse_spec(const char *percent, LogSpec *spec) {
+    const char *p = percent + 1;
+    spec->start = percent;
+    spec->stars = 0;
+    spec->precision = -1;
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL) {
+        p++;
+    }
+    if (*p == '*') {
+        spec->stars++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9') {
+        p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->stars++;
+            spec->precision = LOG_PRECISION_ARG;
+            p++;
+        } else {
+            spec->precision = 0;
+            while (*p >= '0' && *p <= '9') {
+                spec->precision = spec->precision * 10 + (*p++ - '0');
+            }
+        }
+    }
+
+    size_t len = 0;
+    while (*p != '\0' && strchr("hljztL", *p) != NULL && len < sizeof(spec->length) - 1) {
+        spec->length[len++] = *p++;
+    }
+    spec->length[len] = '\0';
+    if (*p == '\0') {
+        return 0;
+    }
+    spec->conversion = *p;
+    spec->end = p + 1;
+    return 1;
+}
+
+// Function to read the next signed integer argument according to its length modifier
+static int64_t log_arg_signed(const LogSpec *spec, va_list *ap) {
+    if (strcmp(spec->length, "l") == 0) {
+        return va_arg(*ap, long);
+    } else if (strcmp(spec->length, "ll") == 0) {
+        return va_arg(*ap, long long);
+    } else if (strcmp(spec->length, "j") == 0) {
+        return va_arg(*ap, intmax_t);
+    } else if (strcmp(spec->length, "z") == 0) {
+        return va_arg(*ap, ssize_t);
+    } else if (strcmp(spec->length, "t") == 0) {
+        return va_arg(*ap, ptrdiff_t);
+    }
+    return va_arg(*ap, int);
+}
+
+// Function to read the next unsigned integer argument according to its length modifier
+static uint64_t log_arg_unsigned(const LogSpec *spec, va_list *ap) {
+    if (strcmp(spec->length, "l") == 0) {
+        return va_arg(*ap, unsigned long);
+    } else if (strcmp(spec->length, "ll") == 0) {
+        return va_arg(*ap, unsigned long long);
+    } else if (strcmp(spec->length, "j") == 0) {
+        return va_arg(*ap, uintmax_t);
+    } else if (strcmp(spec->length, "z") == 0) {
+        return va_arg(*ap, size_t);
+    } else if (strcmp(spec->length, "t") == 0) {
+        return (uint64_t)va_arg(*ap, ptrdiff_t);
+    } else if (strcmp(spec->length, "hh") == 0) {
+        return (unsigned char)va_arg(*ap, unsigned int);
+    } else if (strcmp(spec->length, "h") == 0) {
+        return (unsigned short)va_arg(*ap, unsigned int);
+    }
+    return va_arg(*ap, unsigned int);
+}
+
+// Function to capture the raw argument values of a message into a record (the hot-path half of a log call)
+static void log_capture(LogRecord *record, LogLevel level, const char *fmt, va_list *ap) {
+    clock_gettime(CLOCK_REALTIME, &record->time);
+    record->fmt = fmt;
+    record->level = (uint8_t)level;
+    record->argc = 0;
+    record->text_len = 0;
+    record->text[LOG_TEXT_SIZE - 1] = '\0';
+
+    LogSpec spec;
+    for (const char *p = strchr(fmt, '%'); p != NULL && record->argc < LOG_MAX_ARGS; p = strchr(spec.end, '%')) {
+        if (!log_parse_spec(p, &spec)) {
+            break;
+        }
+        if (spec.conversion == '%') {
+            continue;
+        }
+        // Width and precision arguments precede the value
+        for (int i = 0; i < spec.stars && record->argc < LOG_MAX_ARGS - 1; i++) {
+            int value = va_arg(*ap, int);
+            record->args[record->argc++] = (uint64_t)(int64_t)value;
+            if (i == spec.stars - 1 && spec.precision == LOG_PRECISION_ARG) {
+                spec.precision = value;
+            }
+        }
+        uint64_t *arg = &record->args[record->argc];
+        switch (spec.conversion) {
+            case 'd':
+            case 'i':
+            case 'c':
+                *arg = (uint64_t)log_arg_signed(&spec, ap);
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                *arg = log_arg_unsigned(&spec, ap);
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A': {
+                double value = strcmp(spec.length, "L") == 0 ? (double)va_arg(*ap, long double) : va_arg(*ap, double);
+                memcpy(arg, &value, sizeof(value));
+                break;
+            }
+            case 's': {
+                const char *s = va_arg(*ap, const char *);
+                if (s == NULL) {
+                    s = "(null)";
+                }
+                // The last byte stays an empty string for arguments that no longer fit
+                size_t room = LOG_TEXT_SIZE - 1 - record->text_len;
+                if (room == 0) {
+                    *arg = LOG_TEXT_SIZE - 1;
+                    break;
+                }
+                // A precision bounds strings that need not be NUL-terminated
+                size_t limit = spec.precision >= 0 && (size_t)spec.precision < room - 1 ? (size_t)spec.precision : room - 1;
+                size_t len = strnlen(s, limit);
+                memcpy(record->text + record->text_len, s, len);
+                record->text[record->text_len + len] = '\0';
+                *arg = record->text_len;
+                record->text_len += (uint16_t)(len + 1);
+                break;
+            }
+            default: // %p and anything unexpected are captured as a pointer
+                *arg = (uint64_t)(uintptr_t)va_arg(*ap, void *);
+                break;
+        }
+        record->argc++;
+    }
+}
+
+// Function to format a record into one line of text (the flusher half of a log call)
+static size_t log_format(const LogRecord *record, char *line, size_t size) {
+    struct tm tm;
+    time_t seconds = record->time.tv_sec;
+    localtime_r(&seconds, &tm);
+    int used = snprintf(line, size, "%02d:%02d:%02d.%06ld %-5s ", tm.tm_hour, tm.tm_min, tm.tm_sec,
+                        record->time.tv_nsec / 1000, level_names[record->level]);
+    size_t pos = used > 0 ? (size_t)used : 0;
+
+    const char *p = record->fmt;
+    int argi = 0;
+    LogSpec spec;
+    while (*p != '\0' && pos < size - 1) {
+        const char *percent = strchr(p, '%');
+        size_t literal = percent != NULL ? (size_t)(percent - p) : strlen(p);
+        if (literal > size - 1 - pos) {
+            literal = size - 1 - pos;
+        }
+        memcpy(line + pos, p, literal);
+        pos += literal;
+        if (percent == NULL || !log_parse_spec(percent, &spec)) {
+            break;
+        }
+        p = spec.end;
+        if (spec.conversion == '%') {
+            line[pos++] = '%';
+            continue;
+        }
+        if (argi + spec.stars >= record->argc) {
+            break;
+        }
+
+        // Rebuild the conversion with '*' replaced by the captured width and precision, and a
+        // length modifier matching the widened captured value
+        char conversion[48];
+        size_t flags_len = 0;
+        for (const char *c = spec.start; c < spec.end - 1 - strlen(spec.length) && flags_len < sizeof(conversion) - 16; c++) {
+            if (*c == '*') {
+                flags_len += (size_t)snprintf(conversion + flags_len, 12, "%d", (int)(int64_t)record->args[argi++]);
+            } else {
+                conversion[flags_len++] = *c;
+            }
+        }
+        uint64_t arg = record->args[argi++];
+        int n;
+        switch (spec.conversion) {
+            case 'd':
+            case 'i':
+                snprintf(conversion + flags_len, 4, "ll%c", spec.conversion);
+                n = snprintf(line + pos, size - pos, conversion, (long long)arg);
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                snprintf(conversion + flags_len, 4, "ll%c", spec.conversion);
+                n = snprintf(line + pos, size - pos, conversion, (unsigned long long)arg);
+                break;
+            case 'c':
+                snprintf(conversion + flags_len, 4, "%c", spec.conversion);
+                n = snprintf(line + pos, size - pos, conversion, (int)arg);
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A': {
+                double value;
+                memcpy(&value, &arg, sizeof(value));
+                snprintf(conversion + flags_len, 4, "%c", spec.conversion);
+                n = snprintf(line + pos, size - pos, conversion, value);
+                break;
+            }
+            case 's':
+                snprintf(conversion + flags_len, 4, "s");
+                n = snprintf(line + pos, size - pos, conversion, record->text + arg);
+                break;
+            default:
+                n = snprintf(line + pos, size - pos, "%p", (void *)(uintptr_t)arg);
+                break;
+        }
+        if (n > 0) {
+            pos += (size_t)n < size - pos ? (size_t)n : size - 1 - pos;
+        }
+    }
+    line[pos++] = '\n';
+    return pos;
+}
+
+// Function to register the calling thread's ring with the flusher
+static LogThread *log_register_thread(void) {
+    LogThread *thread = calloc(1, sizeof(*thread));
+    if (thread == NULL || ring_init(&thread->ring, LOG_RING_DEPTH, sizeof(LogRecord)) < 0) {
+        free(thread);
+        log_unavailable = 1;
+        return NULL;
+    }
+    pthread_mutex_lock(&log_lock);
+    thread->next = log_threads;
+    __atomic_store_n(&log_threads, thread, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&log_lock);
+    log_self = thread;
+    return thread;
+}
+
+// Function to format a message and write it immediately (without flushing stdout)
+static void log_vwrite_now(LogLevel level, const char *fmt, va_list *ap) {
+    LogRecord record;
+    char line[LOG_LINE_SIZE];
+    log_capture(&record, level, fmt, ap);
+    fwrite(line, 1, log_format(&record, line, sizeof(line)), stdout);
+}
+
+static void log_write_now(LogLevel level, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite_now(level, fmt, &ap);
+    va_end(ap);
+}
+
+// Function to record a message. Once the flusher runs this only copies the arguments into
+// the calling thread's ring; a full ring drops the record instead of blocking.
+void log_write(LogLevel level, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+        // Before log_init and after log_shutdown messages are written synchronously
+        log_vwrite_now(level, fmt, &ap);
+        va_end(ap);
+        fflush(stdout);
+        return;
+    }
+
+    LogThread *thread = log_self;
+    if (thread == NULL && !log_unavailable) {
+        thread = log_register_thread();
+    }
+    LogRecord *record = thread != NULL ? ring_reserve(&thread->ring) : NULL;
+    if (record != NULL) {
+        log_capture(record, level, fmt, &ap);
+        ring_commit(&thread->ring);
+    }
+    va_end(ap);
+}
+
+// Function to format and write every pending record, then report ring overflow
+static void log_drain(void) {
+    char line[LOG_LINE_SIZE];
+    for (LogThread *thread = __atomic_load_n(&log_threads, __ATOMIC_ACQUIRE); thread != NULL; thread = thread->next) {
+        LogRecord *record;
+        while ((record = ring_peek(&thread->ring)) != NULL) {
+            fwrite(line, 1, log_format(record, line, sizeof(line)), stdout);
+            ring_release(&thread->ring);
+        }
+        uint64_t dropped = ring_dropped(&thread->ring);
+        if (dropped != thread->reported_dropped) {
+            log_write_now(LOG_LEVEL_WARN, "Log ring overflow: %" PRIu64 " records dropped", dropped - thread->reported_dropped);
+            thread->reported_dropped = dropped;
+        }
+    }
+    fflush(stdout);
+}
+
+// Background thread that drains the per-thread rings periodically or on request
+static void *log_flusher_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&log_lock);
+    while (1) {
+        if (log_flush_requested == log_flush_completed && !log_stopping) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_FLUSH_INTERVAL_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&log_wake, &log_lock, &deadline);
+        }
+        uint64_t requested = log_flush_requested;
+        int stopping = log_stopping;
+        pthread_mutex_unlock(&log_lock);
+
+        log_drain();
+
+        pthread_mutex_lock(&log_lock);
+        log_flush_completed = requested;
+        pthread_cond_broadcast(&log_done);
+        if (stopping) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&log_lock);
+    return NULL;
+}
+
+// Function to set the level and sampling rate and start the flusher thread
+int log_init(LogLevel level, uint32_t sample) {
+    log_level = level;
+    log_sample = sample > 0 ? sample : 1;
+    if (log_running) {
+        return 0;
+    }
+    if (pthread_create(&log_flusher, NULL, log_flusher_main, NULL) != 0) {
+        return -1; // Keep logging synchronously
+    }
+    __atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+    atexit(log_shutdown);
+    return 0;
+}
+
+// Function to wait until every record logged so far has been written
+void log_flush(void) {
+    if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+        fflush(stdout);
+        return;
+    }
+    pthread_mutex_lock(&log_lock);
+    uint64_t target = ++log_flush_requested;
+    pthread_cond_signal(&log_wake);
+    while (log_flush_completed < target && !log_stopping) {
+        pthread_cond_wait(&log_done, &log_lock);
+    }
+    pthread_mutex_unlock(&log_lock);
+}
+
+// Function to stop the flusher after it has written all pending records
+void log_shutdown(void) {
+    if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    pthread_mutex_lock(&log_lock);
+    log_stopping = 1;
+    pthread_cond_signal(&log_wake);
+    pthread_mutex_unlock(&log_lock);
+    pthread_join(log_flusher, NULL);
+    __atomic_store_n(&log_running, 0, __ATOMIC_RELEASE);
+}
+
+// Function to map a level name from a configuration file to its level
+LogLevel log_level_from_string(const char *name, LogLevel default_level) {
+    for (int i = LOG_LEVEL_ERROR; i <= LOG_LEVEL_DEBUG; i++) {
+        if (name != NULL && strcasecmp(name, level_names[i]) == 0) {
+            return (LogLevel)i;
+        }
+    }
+    return default_level;
+}
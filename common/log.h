@@ -0,0 +1,47 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+// Severity of a log message; lower values are more severe
+typedef enum {
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG
+} LogLevel;
+
+// Messages above this level are discarded at the call site
+extern LogLevel log_level;
+// Only every log_sample-th debug message from each call site and thread is recorded
+extern uint32_t log_sample;
+
+int log_init(LogLevel level, uint32_t sample);
+void log_flush(void);
+void log_shutdown(void);
+LogLevel log_level_from_string(const char *name, LogLevel default_level);
+void log_write(LogLevel level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// The format must be a string literal: records keep a pointer to it and are formatted later
+// by the flusher thread. String arguments are copied into the record.
+#define LOG(level, ...) \
+    do { \
+        if ((level) <= log_level) { \
+            log_write((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_ERROR(...) LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+
+// Per-packet messages: disabled unless the level is debug, then sampled per call site and thread
+#define LOG_DEBUG(...) \
+    do { \
+        static _Thread_local uint32_t log_seen_; \
+        if (LOG_LEVEL_DEBUG <= log_level && log_seen_++ % log_sample == 0) { \
+            log_write(LOG_LEVEL_DEBUG, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#endif // LOG_H
@@ -1,25 +1,54 @@
 #include "message.h"
+#include "crc32c.h"
 #include <stdint.h> 
 #include <string.h>
 
 // Implement the encoding/decoding functions
 
+// Function to fill in a message header with an uncompressed payload of length bytes
+static void encode_header(CP_Header *header, uint8_t type, size_t length) {
+    header->type = type;
+    header->flags = CP_CODEC_NONE;
+    header->length = length;
+}
+
 void encode_text_message(CP_TextMessage *message, const char *content) {
-    message->header.type = CP_TEXT_MESSAGE;
-    message->header.length = strlen(content);
+    encode_header(&message->header, CP_TEXT_MESSAGE, strlen(content));
     strncpy(message->content, content, MAX_MESSAGE_SIZE);
 }
 
+// Function to encode size bytes of text compressed with codec; returns the number of bytes to send
+size_t encode_compressed_text_message(CP_TextMessage *message, const char *data, uint16_t size, uint8_t codec) {
+    encode_header(&message->header, CP_TEXT_MESSAGE, size);
+    message->header.flags = codec & CP_HEADER_CODEC_MASK;
+    memcpy(message->content, data, size);
+    return offsetof(CP_TextMessage, content) + size;
+}
+
 void decode_text_message(CP_TextMessage *message, char *decoded_content) {
     strncpy(decoded_content, message->content, message->header.length);
     decoded_content[message->header.length] = '\0';
 }
 
-void encode_file_transfer_request(CP_FileTransferRequest *request, const char *filename, uint64_t file_size) {
-    request->header.type = CP_FILE_TRANSFER_REQUEST;
-    request->header.length = sizeof(CP_FileTransferRequest) - sizeof(CP_Header);
+void encode_file_transfer_request(CP_FileTransferRequest *request, const char *filename, uint64_t file_size, uint16_t segment_size, uint8_t flags) {
+    encode_header(&request->header, CP_FILE_TRANSFER_REQUEST, sizeof(CP_FileTransferRequest) - sizeof(CP_Header));
     strncpy(request->filename, filename, MAX_FILENAME_LENGTH);
     request->file_size = file_size;
+    request->segment_size = segment_size;
+    request->flags = flags;
+    request->stripe_of = 0;
+    request->stripe_offset = 0;
+    request->stripe_length = file_size;
+    request->request_id = 0;
+    request->upload_token = 0;
+}
+
+// Function to encode a request for the stripe_offset..stripe_offset+stripe_length-1 part of a file
+void encode_file_stripe_request(CP_FileTransferRequest *request, const char *filename, uint64_t file_size, uint16_t segment_size, uint32_t stripe_of, uint64_t stripe_offset, uint64_t stripe_length) {
+    encode_file_transfer_request(request, filename, file_size, segment_size, CP_TRANSFER_STRIPE);
+    request->stripe_of = stripe_of;
+    request->stripe_offset = stripe_offset;
+    request->stripe_length = stripe_length;
 }
 
 void decode_file_transfer_request(CP_FileTransferRequest *request, char *filename, uint64_t *file_size) {
@@ -28,14 +57,30 @@ void decode_file_transfer_request(CP_FileTransferRequest *request, char *filenam
 }
 
 void encode_file_segment(CP_FileSegment *segment, uint32_t file_id, uint32_t segment_number, const char *data, uint16_t segment_size) {
-    segment->header.type = CP_FILE_SEGMENT;
-    segment->header.length = sizeof(CP_FileSegment) - sizeof(CP_Header) - FILE_SEGMENT_SIZE + segment_size;
+    encode_header(&segment->header, CP_FILE_SEGMENT, offsetof(CP_FileSegment, data) - sizeof(CP_Header) + segment_size);
     segment->file_id = file_id;
     segment->segment_number = segment_number;
+    segment->crc32c = crc32c(0, data, segment_size);
     segment->segment_size = segment_size;
     memcpy(segment->data, data, segment_size);
 }
 
+// Function to encode the header of a segment whose data has the CRC-32C crc
+void encode_file_segment_header(CP_FileSegmentHeader *header, uint32_t file_id, uint32_t segment_number, uint16_t segment_size, uint32_t crc) {
+    encode_header(&header->header, CP_FILE_SEGMENT, offsetof(CP_FileSegment, data) - sizeof(CP_Header) + segment_size);
+    header->file_id = file_id;
+    header->segment_number = segment_number;
+    header->crc32c = crc;
+    header->segment_size = segment_size;
+}
+
+// Function to encode the header of a segment whose data was compressed to compressed_size bytes; crc
+// is still that of the uncompressed data
+void encode_compressed_segment_header(CP_FileSegmentHeader *header, uint32_t file_id, uint32_t segment_number, uint16_t compressed_size, uint8_t codec, uint32_t crc) {
+    encode_file_segment_header(header, file_id, segment_number, compressed_size, crc);
+    header->header.flags = codec & CP_HEADER_CODEC_MASK;
+}
+
 void decode_file_segment(CP_FileSegment *segment, uint32_t *file_id, uint32_t *segment_number, char *data, uint16_t *segment_size) {
     *file_id = segment->file_id;
     *segment_number = segment->segment_number;
@@ -44,8 +89,7 @@ void decode_file_segment(CP_FileSegment *segment, uint32_t *file_id, uint32_t *s
 }
 
 void encode_file_segment_ack(CP_FileSegmentAck *ack, uint32_t file_id, uint32_t segment_number) {
-    ack->header.type = CP_FILE_SEGMENT_ACK;
-    ack->header.length = sizeof(CP_FileSegmentAck) - sizeof(CP_Header);
+    encode_header(&ack->header, CP_FILE_SEGMENT_ACK, sizeof(CP_FileSegmentAck) - sizeof(CP_Header));
     ack->file_id = file_id;
     ack->segment_number = segment_number;
 }
@@ -55,12 +99,312 @@ void decode_file_segment_ack(CP_FileSegmentAck *ack, uint32_t *file_id, uint32_t
     *segment_number = ack->segment_number;
 }
 
-void encode_file_transfer_complete(CP_FileTransferComplete *complete, uint32_t file_id) {
-    complete->header.type = CP_FILE_TRANSFER_COMPLETE;
-    complete->header.length = sizeof(CP_FileTransferComplete) - sizeof(CP_Header);
+void encode_file_transfer_complete(CP_FileTransferComplete *complete, uint32_t file_id, uint64_t file_hash) {
+    encode_header(&complete->header, CP_FILE_TRANSFER_COMPLETE, sizeof(CP_FileTransferComplete) - sizeof(CP_Header));
     complete->file_id = file_id;
+    complete->file_hash = file_hash;
 }
 
 void decode_file_transfer_complete(CP_FileTransferComplete *complete, uint32_t *file_id) {
     *file_id = complete->file_id;
 }
+
+void encode_file_transfer_response(CP_FileTransferResponse *response, uint32_t file_id, uint16_t segment_size, uint8_t status, uint32_t received_segments, uint8_t flags, uint32_t request_id, uint64_t upload_token) {
+    encode_header(&response->header, CP_FILE_TRANSFER_RESPONSE, sizeof(CP_FileTransferResponse) - sizeof(CP_Header));
+    response->file_id = file_id;
+    response->segment_size = segment_size;
+    response->status = status;
+    response->received_segments = received_segments;
+    response->flags = flags;
+    response->request_id = request_id;
+    response->upload_token = upload_token;
+}
+
+void decode_file_transfer_response(CP_FileTransferResponse *response, uint32_t *file_id) {
+    *file_id = response->file_id;
+}
+
+// Function to compute the size of an encoded segment carrying segment_size bytes of data
+size_t file_segment_wire_size(uint16_t segment_size) {
+    return offsetof(CP_FileSegment, data) + segment_size;
+}
+
+void encode_session_hello(CP_SessionHello *hello, uint8_t codecs) {
+    encode_header(&hello->header, CP_SESSION_HELLO, sizeof(CP_SessionHello) - sizeof(CP_Header));
+    hello->codecs = codecs;
+}
+
+// Function to encode a path MTU probe into a buffer of probe_size bytes, zero-padding the rest
+void encode_path_probe(char *buffer, uint16_t probe_size) {
+    CP_PathProbe probe;
+    encode_header(&probe.header, CP_PATH_PROBE, probe_size - sizeof(CP_Header));
+    probe.probe_size = probe_size;
+    memset(buffer, 0, probe_size);
+    memcpy(buffer, &probe, sizeof(probe));
+}
+
+void encode_path_probe_ack(CP_PathProbeAck *ack, uint16_t probe_size, uint16_t received_size) {
+    encode_header(&ack->header, CP_PATH_PROBE_ACK, sizeof(CP_PathProbeAck) - sizeof(CP_Header));
+    ack->probe_size = probe_size;
+    ack->received_size = received_size;
+}
+
+// Function to encode chunk_count manifest entries; returns the number of bytes to send
+size_t encode_chunk_manifest(CP_ChunkManifest *manifest, uint32_t file_id, uint32_t total_chunks, uint32_t first_chunk, uint64_t offset, const CP_ChunkEntry *chunks, uint16_t chunk_count) {
+    if (chunk_count > CP_MAX_MANIFEST_CHUNKS) {
+        chunk_count = CP_MAX_MANIFEST_CHUNKS;
+    }
+    encode_header(&manifest->header, CP_CHUNK_MANIFEST, offsetof(CP_ChunkManifest, chunks) - sizeof(CP_Header) + chunk_count * sizeof(CP_ChunkEntry));
+    manifest->file_id = file_id;
+    manifest->total_chunks = total_chunks;
+    manifest->first_chunk = first_chunk;
+    manifest->offset = offset;
+    manifest->chunk_count = chunk_count;
+    memcpy(manifest->chunks, chunks, chunk_count * sizeof(CP_ChunkEntry));
+    return sizeof(CP_Header) + manifest->header.length;
+}
+
+// Function to encode the known-chunk bitmap answering a manifest; returns the number of bytes to send
+size_t encode_chunk_manifest_ack(CP_ChunkManifestAck *ack, uint32_t file_id, uint32_t first_chunk, const uint8_t *known, uint16_t chunk_count) {
+    if (chunk_count > CP_MAX_MANIFEST_CHUNKS) {
+        chunk_count = CP_MAX_MANIFEST_CHUNKS;
+    }
+    encode_header(&ack->header, CP_CHUNK_MANIFEST_ACK, offsetof(CP_ChunkManifestAck, known) - sizeof(CP_Header) + (chunk_count + 7) / 8);
+    ack->file_id = file_id;
+    ack->first_chunk = first_chunk;
+    ack->chunk_count = chunk_count;
+    memcpy(ack->known, known, (chunk_count + 7) / 8);
+    return sizeof(CP_Header) + ack->header.length;
+}
+
+// Returns the number of bytes to send: the header plus only the ranges in use
+size_t encode_file_segment_sack(CP_FileSegmentSack *sack, uint32_t file_id, uint32_t cumulative, const CP_SackRange *ranges, uint16_t range_count) {
+    if (range_count > CP_MAX_SACK_RANGES) {
+        range_count = CP_MAX_SACK_RANGES;
+    }
+    encode_header(&sack->header, CP_FILE_SEGMENT_SACK, offsetof(CP_FileSegmentSack, ranges) - sizeof(CP_Header) + range_count * sizeof(CP_SackRange));
+    sack->file_id = file_id;
+    sack->cumulative = cumulative;
+    sack->range_count = range_count;
+    if (range_count > 0) {
+        memcpy(sack->ranges, ranges, range_count * sizeof(CP_SackRange));
+    }
+    return sizeof(CP_Header) + sack->header.length;
+}
+
+// Zero-copy accessors for received messages. Fields are read with memcpy at their struct offsets
+// because the receive buffer carries no alignment guarantee; each function returns 0 on success or
+// -1 if the datagram has the wrong type or is too short for the fields it claims to carry.
+
+// Function to read a field of size bytes at offset, failing if it lies beyond the datagram
+static int view_field(const char *buffer, size_t size, size_t offset, void *field, size_t field_size) {
+    if (offset + field_size > size) {
+        return -1;
+    }
+    memcpy(field, buffer + offset, field_size);
+    return 0;
+}
+
+// Function to return the message type of a datagram, or -1 if it is shorter than a header
+int view_message_type(const char *buffer, size_t size) {
+    uint8_t type;
+    if (size < sizeof(CP_Header) || view_field(buffer, size, offsetof(CP_Header, type), &type, sizeof(type)) < 0) {
+        return -1;
+    }
+    return type;
+}
+
+// Function to read the payload codec of a datagram already known to hold a header
+static uint8_t view_codec(const char *buffer) {
+    uint8_t flags;
+    memcpy(&flags, buffer + offsetof(CP_Header, flags), sizeof(flags));
+    return flags & CP_HEADER_CODEC_MASK;
+}
+
+int view_text_message(const char *buffer, size_t size, CP_TextMessageView *view) {
+    if (view_message_type(buffer, size) != CP_TEXT_MESSAGE ||
+        view_field(buffer, size, offsetof(CP_Header, length), &view->length, sizeof(view->length)) < 0) {
+        return -1;
+    }
+    if (view->length > MAX_MESSAGE_SIZE || offsetof(CP_TextMessage, content) + view->length > size) {
+        return -1;
+    }
+    view->content = buffer + offsetof(CP_TextMessage, content);
+    view->codec = view_codec(buffer);
+    return 0;
+}
+
+int view_file_transfer_request(const char *buffer, size_t size, CP_FileTransferRequestView *view) {
+    if (view_message_type(buffer, size) != CP_FILE_TRANSFER_REQUEST ||
+        view_field(buffer, size, offsetof(CP_FileTransferRequest, file_size), &view->file_size, sizeof(view->file_size)) < 0) {
+        return -1;
+    }
+    // The filename is used in place, so it must be terminated inside its field
+    view->filename = buffer + offsetof(CP_FileTransferRequest, filename);
+    if (memchr(view->filename, '\0', MAX_FILENAME_LENGTH) == NULL) {
+        return -1;
+    }
+    // Requests that predate segment size negotiation end after file_size
+    if (view_field(buffer, size, offsetof(CP_FileTransferRequest, segment_size), &view->segment_size, sizeof(view->segment_size)) < 0) {
+        view->segment_size = 0;
+    }
+    if (view_field(buffer, size, offsetof(CP_FileTransferRequest, flags), &view->flags, sizeof(view->flags)) < 0) {
+        view->flags = 0;
+    }
+    if ((view->flags & CP_TRANSFER_STRIPE) &&
+        (view_field(buffer, size, offsetof(CP_FileTransferRequest, stripe_of), &view->stripe_of, sizeof(view->stripe_of)) < 0 ||
+         view_field(buffer, size, offsetof(CP_FileTransferRequest, stripe_offset), &view->stripe_offset, sizeof(view->stripe_offset)) < 0 ||
+         view_field(buffer, size, offsetof(CP_FileTransferRequest, stripe_length), &view->stripe_length, sizeof(view->stripe_length)) < 0)) {
+        return -1;
+    }
+    if (view_field(buffer, size, offsetof(CP_FileTransferRequest, request_id), &view->request_id, sizeof(view->request_id)) < 0) {
+        view->request_id = 0;
+    }
+    if (view_field(buffer, size, offsetof(CP_FileTransferRequest, upload_token), &view->upload_token, sizeof(view->upload_token)) < 0) {
+        view->upload_token = 0;
+    }
+    return 0;
+}
+
+int view_file_segment(const char *buffer, size_t size, CP_FileSegmentView *view) {
+    if (view_message_type(buffer, size) != CP_FILE_SEGMENT ||
+        view_field(buffer, size, offsetof(CP_FileSegment, file_id), &view->file_id, sizeof(view->file_id)) < 0 ||
+        view_field(buffer, size, offsetof(CP_FileSegment, segment_number), &view->segment_number, sizeof(view->segment_number)) < 0 ||
+        view_field(buffer, size, offsetof(CP_FileSegment, crc32c), &view->crc32c, sizeof(view->crc32c)) < 0 ||
+        view_field(buffer, size, offsetof(CP_FileSegment, segment_size), &view->segment_size, sizeof(view->segment_size)) < 0) {
+        return -1;
+    }
+    if (view->segment_size > CP_MAX_SEGMENT_SIZE || offsetof(CP_FileSegment, data) + view->segment_size > size) {
+        return -1;
+    }
+    view->data = buffer + offsetof(CP_FileSegment, data);
+    view->codec = view_codec(buffer);
+    return 0;
+}
+
+int view_file_segment_ack(const char *buffer, size_t size, CP_FileSegmentAckView *view) {
+    if (view_message_type(buffer, size) != CP_FILE_SEGMENT_ACK ||
+        view_field(buffer, size, offsetof(CP_FileSegmentAck, file_id), &view->file_id, sizeof(view->file_id)) < 0 ||
+        view_field(buffer, size, offsetof(CP_FileSegmentAck, segment_number), &view->segment_number, sizeof(view->segment_number)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int view_file_segment_sack(const char *buffer, size_t size, CP_FileSegmentSackView *view) {
+    if (view_message_type(buffer, size) != CP_FILE_SEGMENT_SACK ||
+        view_field(buffer, size, offsetof(CP_FileSegmentSack, file_id), &view->file_id, sizeof(view->file_id)) < 0 ||
+        view_field(buffer, size, offsetof(CP_FileSegmentSack, cumulative), &view->cumulative, sizeof(view->cumulative)) < 0 ||
+        view_field(buffer, size, offsetof(CP_FileSegmentSack, range_count), &view->range_count, sizeof(view->range_count)) < 0) {
+        return -1;
+    }
+    if (view->range_count > CP_MAX_SACK_RANGES || offsetof(CP_FileSegmentSack, ranges) + view->range_count * sizeof(CP_SackRange) > size) {
+        return -1;
+    }
+    view->ranges = buffer + offsetof(CP_FileSegmentSack, ranges);
+    return 0;
+}
+
+// Function to read range index of a validated selective acknowledgment
+void view_sack_range(const CP_FileSegmentSackView *view, uint16_t index, CP_SackRange *range) {
+    memcpy(range, view->ranges + index * sizeof(CP_SackRange), sizeof(*range));
+}
+
+int view_chunk_manifest(const char *buffer, size_t size, CP_ChunkManifestView *view) {
+    if (view_message_type(buffer, size) != CP_CHUNK_MANIFEST ||
+        view_field(buffer, size, offsetof(CP_ChunkManifest, file_id), &view->file_id, sizeof(view->file_id)) < 0 ||
+        view_field(buffer, size, offsetof(CP_ChunkManifest, total_chunks), &view->total_chunks, sizeof(view->total_chunks)) < 0 ||
+        view_field(buffer, size, offsetof(CP_ChunkManifest, first_chunk), &view->first_chunk, sizeof(view->first_chunk)) < 0 ||
+        view_field(buffer, size, offsetof(CP_ChunkManifest, offset), &view->offset, sizeof(view->offset)) < 0 ||
+        view_field(buffer, size, offsetof(CP_ChunkManifest, chunk_count), &view->chunk_count, sizeof(view->chunk_count)) < 0) {
+        return -1;
+    }
+    if (view->chunk_count > CP_MAX_MANIFEST_CHUNKS || offsetof(CP_ChunkManifest, chunks) + view->chunk_count * sizeof(CP_ChunkEntry) > size) {
+        return -1;
+    }
+    view->chunks = buffer + offsetof(CP_ChunkManifest, chunks);
+    return 0;
+}
+
+void view_chunk_entry(const CP_ChunkManifestView *view, uint16_t index, CP_ChunkEntry *entry) {
+    memcpy(entry, view->chunks + index * sizeof(CP_ChunkEntry), sizeof(*entry));
+}
+
+int view_chunk_manifest_ack(const char *buffer, size_t size, CP_ChunkManifestAckView *view) {
+    if (view_message_type(buffer, size) != CP_CHUNK_MANIFEST_ACK ||
+        view_field(buffer, size, offsetof(CP_ChunkManifestAck, file_id), &view->file_id, sizeof(view->file_id)) < 0 ||
+        view_field(buffer, size, offsetof(CP_ChunkManifestAck, first_chunk), &view->first_chunk, sizeof(view->first_chunk)) < 0 ||
+        view_field(buffer, size, offsetof(CP_ChunkManifestAck, chunk_count), &view->chunk_count, sizeof(view->chunk_count)) < 0) {
+        return -1;
+    }
+    if (view->chunk_count > CP_MAX_MANIFEST_CHUNKS || offsetof(CP_ChunkManifestAck, known) + (view->chunk_count + 7) / 8 > size) {
+        return -1;
+    }
+    view->known = (const uint8_t *)buffer + offsetof(CP_ChunkManifestAck, known);
+    return 0;
+}
+
+int view_file_transfer_complete(const char *buffer, size_t size, CP_FileTransferCompleteView *view) {
+    if (view_message_type(buffer, size) != CP_FILE_TRANSFER_COMPLETE ||
+        view_field(buffer, size, offsetof(CP_FileTransferComplete, file_id), &view->file_id, sizeof(view->file_id)) < 0) {
+        return -1;
+    }
+    // Completions that predate the whole-file hash end after file_id
+    view->has_hash = view_field(buffer, size, offsetof(CP_FileTransferComplete, file_hash), &view->file_hash, sizeof(view->file_hash)) == 0;
+    if (!view->has_hash) {
+        view->file_hash = 0;
+    }
+    return 0;
+}
+
+int view_file_transfer_response(const char *buffer, size_t size, CP_FileTransferResponseView *view) {
+    if (view_message_type(buffer, size) != CP_FILE_TRANSFER_RESPONSE ||
+        view_field(buffer, size, offsetof(CP_FileTransferResponse, file_id), &view->file_id, sizeof(view->file_id)) < 0) {
+        return -1;
+    }
+    if (view_field(buffer, size, offsetof(CP_FileTransferResponse, segment_size), &view->segment_size, sizeof(view->segment_size)) < 0 ||
+        view->segment_size == 0) {
+        view->segment_size = FILE_SEGMENT_SIZE;
+    }
+    if (view_field(buffer, size, offsetof(CP_FileTransferResponse, status), &view->status, sizeof(view->status)) < 0) {
+        view->status = CP_TRANSFER_ACCEPTED;
+    }
+    if (view_field(buffer, size, offsetof(CP_FileTransferResponse, received_segments), &view->received_segments, sizeof(view->received_segments)) < 0) {
+        view->received_segments = 0;
+    }
+    if (view_field(buffer, size, offsetof(CP_FileTransferResponse, flags), &view->flags, sizeof(view->flags)) < 0) {
+        view->flags = 0;
+    }
+    if (view_field(buffer, size, offsetof(CP_FileTransferResponse, request_id), &view->request_id, sizeof(view->request_id)) < 0) {
+        view->request_id = 0;
+    }
+    if (view_field(buffer, size, offsetof(CP_FileTransferResponse, upload_token), &view->upload_token, sizeof(view->upload_token)) < 0) {
+        view->upload_token = 0;
+    }
+    return 0;
+}
+
+int view_session_hello(const char *buffer, size_t size, uint8_t *codecs) {
+    if (view_message_type(buffer, size) != CP_SESSION_HELLO ||
+        view_field(buffer, size, offsetof(CP_SessionHello, codecs), codecs, sizeof(*codecs)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int view_path_probe(const char *buffer, size_t size, CP_PathProbeView *view) {
+    if (view_message_type(buffer, size) != CP_PATH_PROBE ||
+        view_field(buffer, size, offsetof(CP_PathProbe, probe_size), &view->probe_size, sizeof(view->probe_size)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int view_path_probe_ack(const char *buffer, size_t size, CP_PathProbeView *view) {
+    if (view_message_type(buffer, size) != CP_PATH_PROBE_ACK ||
+        view_field(buffer, size, offsetof(CP_PathProbeAck, probe_size), &view->probe_size, sizeof(view->probe_size)) < 0 ||
+        view_field(buffer, size, offsetof(CP_PathProbeAck, received_size), &view->received_size, sizeof(view->received_size)) < 0) {
+        return -1;
+    }
+    return 0;
+}
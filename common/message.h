@@ -1,11 +1,16 @@
 #ifndef MESSAGE_H
 #define MESSAGE_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define MAX_MESSAGE_SIZE 1024
 #define MAX_FILENAME_LENGTH 256
-#define FILE_SEGMENT_SIZE 512
+#define FILE_SEGMENT_SIZE 512 // Segment payload used when a request does not negotiate one
+
+// Largest UDP payload of an IPv4 datagram, and the largest segment payload that fits in one
+#define CP_MAX_DATAGRAM_SIZE 65507
+#define CP_MAX_SEGMENT_SIZE 65489
 
 // Message types
 #define CP_TEXT_MESSAGE 1
@@ -13,9 +18,40 @@
 #define CP_FILE_SEGMENT 3
 #define CP_FILE_SEGMENT_ACK 4
 #define CP_FILE_TRANSFER_COMPLETE 5
+#define CP_FILE_TRANSFER_RESPONSE 6
+#define CP_FILE_SEGMENT_SACK 7
+#define CP_PATH_PROBE 8
+#define CP_PATH_PROBE_ACK 9
+#define CP_CHUNK_MANIFEST 10
+#define CP_CHUNK_MANIFEST_ACK 11
+#define CP_SESSION_HELLO 12
+
+// Payload codecs. The low bits of CP_Header.flags name the codec a message's payload (text
+// content or segment data) was compressed with; CP_CODEC_NONE means it is sent as is.
+#define CP_HEADER_CODEC_MASK 0x0f
+#define CP_CODEC_NONE 0
+#define CP_CODEC_LZ 1 // LZ4 block format
+
+// Outcome of a file transfer request, carried in CP_FileTransferResponse
+#define CP_TRANSFER_ACCEPTED 0
+#define CP_TRANSFER_REJECTED 1 // The server could not set up the transfer
+#define CP_TRANSFER_NO_SPACE 2 // The server's volume cannot hold the file
+
+// CP_FileTransferRequest flags
+#define CP_TRANSFER_RESUME 0x01 // Continue the interrupted upload named by upload_token if the server has it
+#define CP_TRANSFER_DEDUP 0x02 // Announce the file's chunks first and skip those the server stores
+#define CP_TRANSFER_STRIPE 0x04 // Upload only the stripe_offset/stripe_length part of the file
+
+// Size of the SHA-256 hash naming a chunk, and the most chunks one manifest message lists
+#define CP_CHUNK_HASH_SIZE 32
+#define CP_MAX_MANIFEST_CHUNKS 1024
+
+// Maximum number of received ranges reported in one selective acknowledgment
+#define CP_MAX_SACK_RANGES 16
 
 typedef struct {
     uint8_t type;
+    uint8_t flags; // CP_HEADER_CODEC_MASK bits; zero in messages that predate compression
     uint16_t length;
 } CP_Header;
 
@@ -28,16 +64,37 @@ typedef struct {
     CP_Header header;
     char filename[MAX_FILENAME_LENGTH];
     uint64_t file_size;
+    uint16_t segment_size; // Requested payload per segment; absent or 0 means FILE_SEGMENT_SIZE
+    uint8_t flags; // CP_TRANSFER_* request flags
+    // With CP_TRANSFER_STRIPE: the byte range this transfer carries (its segments are numbered
+    // from stripe_offset), and the file ID of the upload whose file it writes into, or 0 for the
+    // first stripe, which creates the file
+    uint32_t stripe_of;
+    uint64_t stripe_offset;
+    uint64_t stripe_length;
+    uint32_t request_id; // Chosen by the client and echoed in the response; never 0
+    uint64_t upload_token; // With CP_TRANSFER_RESUME: the token the server gave the interrupted upload
 } CP_FileTransferRequest;
 
 typedef struct {
     CP_Header header;
     uint32_t file_id;
     uint32_t segment_number;
+    uint32_t crc32c; // CRC-32C of the segment's data before compression
     uint16_t segment_size;
-    char data[FILE_SEGMENT_SIZE];
+    char data[CP_MAX_SEGMENT_SIZE]; // Only segment_size bytes are sent
 } CP_FileSegment;
 
+// The fields of a CP_FileSegment in front of its data, for senders that gather the payload from
+// elsewhere. Only file_segment_wire_size(0) bytes of it go on the wire.
+typedef struct {
+    CP_Header header;
+    uint32_t file_id;
+    uint32_t segment_number;
+    uint32_t crc32c;
+    uint16_t segment_size;
+} CP_FileSegmentHeader;
+
 typedef struct {
     CP_Header header;
     uint32_t file_id;
@@ -47,17 +104,206 @@ typedef struct {
 typedef struct {
     CP_Header header;
     uint32_t file_id;
+    uint64_t file_hash; // XXH64 (seed 0) of the transferred range of the file; 0 when not sent
 } CP_FileTransferComplete;
 
+// Sent by the server in reply to a CP_FileTransferRequest with the assigned file ID, or with a
+// status other than CP_TRANSFER_ACCEPTED (and no file ID) when the request is turned down.
+// A resumed upload starts at received_segments; a SACK listing any segments the server holds
+// beyond it follows the response.
+typedef struct {
+    CP_Header header;
+    uint32_t file_id;
+    uint16_t segment_size; // Payload every segment but the last must carry
+    uint8_t status;
+    uint32_t received_segments; // Segments already stored in order, 0 for a new upload
+    uint8_t flags; // The request flags the server honours
+    uint32_t request_id; // Copied from the request this answers
+    uint64_t upload_token; // Names this upload in a later resume request; 0 when it cannot be resumed
+} CP_FileTransferResponse;
+
+// Sent by the client when it starts with the codecs it can use (bit 1 << CP_CODEC_*), and
+// echoed by the server with those it can decode as well. A client only compresses with a codec
+// the server confirmed.
+typedef struct {
+    CP_Header header;
+    uint8_t codecs;
+} CP_SessionHello;
+
+// Path MTU probe, padded to probe_size bytes. A probe too large for the path never arrives; one
+// too large for the server's receive buffer arrives truncated, and the acknowledgment says so.
+typedef struct {
+    CP_Header header;
+    uint16_t probe_size;
+} CP_PathProbe;
+
+typedef struct {
+    CP_Header header;
+    uint16_t probe_size;
+    uint16_t received_size; // Bytes of the probe the server received
+} CP_PathProbeAck;
+
+// Segments start to end - 1 received beyond the cumulative acknowledgment
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} CP_SackRange;
+
+// Selective acknowledgment sent by the server in place of one CP_FileSegmentAck per segment.
+// Only the first range_count ranges are sent; header.length covers exactly those.
+typedef struct {
+    CP_Header header;
+    uint32_t file_id;
+    uint32_t cumulative; // Every segment below this number has been received
+    uint16_t range_count;
+    CP_SackRange ranges[CP_MAX_SACK_RANGES];
+} CP_FileSegmentSack;
+
+typedef struct {
+    uint8_t hash[CP_CHUNK_HASH_SIZE]; // SHA-256 of the chunk's bytes
+    uint32_t length;
+} CP_ChunkEntry;
+
+// Part of the list of a file's content-defined chunks, sent by a client whose transfer was granted
+// CP_TRANSFER_DEDUP before any segments. The chunks listed are consecutive and start at offset.
+// Only the first chunk_count entries are sent; header.length covers exactly those.
+typedef struct {
+    CP_Header header;
+    uint32_t file_id;
+    uint32_t total_chunks; // Chunks in the whole file
+    uint32_t first_chunk; // Index of chunks[0] in the file
+    uint64_t offset; // File offset of chunks[0]
+    uint16_t chunk_count;
+    CP_ChunkEntry chunks[CP_MAX_MANIFEST_CHUNKS];
+} CP_ChunkManifest;
+
+// Reply to a CP_ChunkManifest: bit i of known is set when the server already stored chunk
+// first_chunk + i and has written it into the file
+typedef struct {
+    CP_Header header;
+    uint32_t file_id;
+    uint32_t first_chunk;
+    uint16_t chunk_count;
+    uint8_t known[CP_MAX_MANIFEST_CHUNKS / 8];
+} CP_ChunkManifestAck;
+
+// Read-only views of a received message. The view_* functions check the message type and that
+// every field fits in the datagram, then read the fields straight from the receive buffer; payload
+// pointers refer into that buffer and are only valid as long as it is.
+typedef struct {
+    const char *content; // Not NUL-terminated; compressed unless codec is CP_CODEC_NONE
+    uint16_t length;
+    uint8_t codec;
+} CP_TextMessageView;
+
+typedef struct {
+    const char *filename; // NUL-terminated
+    uint64_t file_size;
+    uint16_t segment_size; // 0 when not requested
+    uint8_t flags; // 0 when not sent
+    uint32_t stripe_of; // Only read with CP_TRANSFER_STRIPE
+    uint64_t stripe_offset;
+    uint64_t stripe_length;
+    uint32_t request_id; // 0 when not sent
+    uint64_t upload_token; // 0 when not sent
+} CP_FileTransferRequestView;
+
+typedef struct {
+    uint32_t file_id;
+    uint32_t segment_number;
+    uint32_t crc32c; // Of the data once decompressed
+    uint16_t segment_size; // Bytes of data carried, compressed unless codec is CP_CODEC_NONE
+    uint8_t codec;
+    const char *data;
+} CP_FileSegmentView;
+
+typedef struct {
+    uint32_t file_id;
+    uint32_t segment_number;
+} CP_FileSegmentAckView;
+
+typedef struct {
+    uint32_t file_id;
+    uint32_t cumulative;
+    uint16_t range_count;
+    const char *ranges; // range_count unaligned CP_SackRange entries, read with view_sack_range
+} CP_FileSegmentSackView;
+
+typedef struct {
+    uint32_t file_id;
+    uint64_t file_hash;
+    int has_hash; // 0 for messages that predate the whole-file hash
+} CP_FileTransferCompleteView;
+
+typedef struct {
+    uint32_t file_id;
+    uint16_t segment_size; // FILE_SEGMENT_SIZE when not negotiated
+    uint8_t status; // CP_TRANSFER_ACCEPTED when not reported
+    uint32_t received_segments; // 0 when not reported
+    uint8_t flags; // 0 when not reported
+    uint32_t request_id; // 0 when not echoed
+    uint64_t upload_token; // 0 when not reported
+} CP_FileTransferResponseView;
+
+typedef struct {
+    uint32_t file_id;
+    uint32_t total_chunks;
+    uint32_t first_chunk;
+    uint64_t offset;
+    uint16_t chunk_count;
+    const char *chunks; // chunk_count unaligned CP_ChunkEntry entries, read with view_chunk_entry
+} CP_ChunkManifestView;
+
+typedef struct {
+    uint32_t file_id;
+    uint32_t first_chunk;
+    uint16_t chunk_count;
+    const uint8_t *known; // (chunk_count + 7) / 8 bytes
+} CP_ChunkManifestAckView;
+
+typedef struct {
+    uint16_t probe_size;
+    uint16_t received_size; // Only set for acknowledgments
+} CP_PathProbeView;
+
 void encode_text_message(CP_TextMessage *message, const char *text);
 void decode_text_message(CP_TextMessage *message, char *text);
-void encode_file_transfer_request(CP_FileTransferRequest *request, const char *filename, uint64_t file_size);
+size_t encode_compressed_text_message(CP_TextMessage *message, const char *data, uint16_t size, uint8_t codec);
+void encode_file_transfer_request(CP_FileTransferRequest *request, const char *filename, uint64_t file_size, uint16_t segment_size, uint8_t flags);
+void encode_file_stripe_request(CP_FileTransferRequest *request, const char *filename, uint64_t file_size, uint16_t segment_size, uint32_t stripe_of, uint64_t stripe_offset, uint64_t stripe_length);
 void decode_file_transfer_request(CP_FileTransferRequest *request, char *filename, uint64_t *file_size);
 void encode_file_segment(CP_FileSegment *segment, uint32_t file_id, uint32_t segment_number, const char *data, uint16_t segment_size);
+void encode_file_segment_header(CP_FileSegmentHeader *header, uint32_t file_id, uint32_t segment_number, uint16_t segment_size, uint32_t crc);
+void encode_compressed_segment_header(CP_FileSegmentHeader *header, uint32_t file_id, uint32_t segment_number, uint16_t compressed_size, uint8_t codec, uint32_t crc);
 void decode_file_segment(CP_FileSegment *segment, uint32_t *file_id, uint32_t *segment_number, char *data, uint16_t *segment_size);
 void encode_file_segment_ack(CP_FileSegmentAck *ack, uint32_t file_id, uint32_t segment_number);
 void decode_file_segment_ack(CP_FileSegmentAck *ack, uint32_t *file_id, uint32_t *segment_number);
-void encode_file_transfer_complete(CP_FileTransferComplete *complete, uint32_t file_id);
+void encode_file_transfer_complete(CP_FileTransferComplete *complete, uint32_t file_id, uint64_t file_hash);
 void decode_file_transfer_complete(CP_FileTransferComplete *complete, uint32_t *file_id);
+void encode_file_transfer_response(CP_FileTransferResponse *response, uint32_t file_id, uint16_t segment_size, uint8_t status, uint32_t received_segments, uint8_t flags, uint32_t request_id, uint64_t upload_token);
+void decode_file_transfer_response(CP_FileTransferResponse *response, uint32_t *file_id);
+size_t file_segment_wire_size(uint16_t segment_size);
+void encode_session_hello(CP_SessionHello *hello, uint8_t codecs);
+void encode_path_probe(char *buffer, uint16_t probe_size);
+void encode_path_probe_ack(CP_PathProbeAck *ack, uint16_t probe_size, uint16_t received_size);
+size_t encode_chunk_manifest(CP_ChunkManifest *manifest, uint32_t file_id, uint32_t total_chunks, uint32_t first_chunk, uint64_t offset, const CP_ChunkEntry *chunks, uint16_t chunk_count);
+size_t encode_chunk_manifest_ack(CP_ChunkManifestAck *ack, uint32_t file_id, uint32_t first_chunk, const uint8_t *known, uint16_t chunk_count);
+size_t encode_file_segment_sack(CP_FileSegmentSack *sack, uint32_t file_id, uint32_t cumulative, const CP_SackRange *ranges, uint16_t range_count);
+
+int view_message_type(const char *buffer, size_t size);
+int view_text_message(const char *buffer, size_t size, CP_TextMessageView *view);
+int view_file_transfer_request(const char *buffer, size_t size, CP_FileTransferRequestView *view);
+int view_file_segment(const char *buffer, size_t size, CP_FileSegmentView *view);
+int view_file_segment_ack(const char *buffer, size_t size, CP_FileSegmentAckView *view);
+int view_file_segment_sack(const char *buffer, size_t size, CP_FileSegmentSackView *view);
+void view_sack_range(const CP_FileSegmentSackView *view, uint16_t index, CP_SackRange *range);
+int view_file_transfer_complete(const char *buffer, size_t size, CP_FileTransferCompleteView *view);
+int view_file_transfer_response(const char *buffer, size_t size, CP_FileTransferResponseView *view);
+int view_session_hello(const char *buffer, size_t size, uint8_t *codecs);
+int view_path_probe(const char *buffer, size_t size, CP_PathProbeView *view);
+int view_path_probe_ack(const char *buffer, size_t size, CP_PathProbeView *view);
+int view_chunk_manifest(const char *buffer, size_t size, CP_ChunkManifestView *view);
+void view_chunk_entry(const CP_ChunkManifestView *view, uint16_t index, CP_ChunkEntry *entry);
+int view_chunk_manifest_ack(const char *buffer, size_t size, CP_ChunkManifestAckView *view);
 
 #endif // MESSAGE_H
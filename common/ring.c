@@ -0,0 +1,63 @@
+#include "ring.h"
+#include <stdlib.h>
+
+// Function to allocate a ring with capacity rounded up to a power of two
+int ring_init(SpscRing *ring, uint32_t capacity, size_t slot_size) {
+    uint32_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+    ring->slot_size = slot_size;
+    ring->mask = size - 1;
+    ring->slots = calloc(size, slot_size);
+    return ring->slots == NULL ? -1 : 0;
+}
+
+void ring_free(SpscRing *ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+// Function for the producer to claim the next free slot, or NULL (counted) if the ring is full
+void *ring_reserve(SpscRing *ring) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (ring->tail - head > ring->mask) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    return ring->slots + (size_t)(ring->tail & ring->mask) * ring->slot_size;
+}
+
+// Function for the producer to publish the slot returned by ring_reserve
+void ring_commit(SpscRing *ring) {
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+// Function for the consumer to get the oldest published slot, or NULL if the ring is empty
+void *ring_peek(SpscRing *ring) {
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (ring->head == tail) {
+        return NULL;
+    }
+    return ring->slots + (size_t)(ring->head & ring->mask) * ring->slot_size;
+}
+
+// Function for the consumer to hand the slot returned by ring_peek back to the producer
+void ring_release(SpscRing *ring) {
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+// Function for the consumer to check for pending slots with full ordering, so it can
+// safely decide to sleep after announcing that it is about to
+int ring_empty(SpscRing *ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_RELAXED) == __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+}
+
+// Function to read the overflow counter from any thread
+uint64_t ring_dropped(SpscRing *ring) {
+    return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
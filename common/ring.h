@@ -0,0 +1,29 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded lock-free single-producer/single-consumer ring of fixed-size slots.
+// The producer reserves a slot, fills it in place and commits it; the consumer
+// peeks at the oldest slot and releases it when done. A full ring never blocks:
+// the producer gets NULL and the overflow is counted in dropped.
+typedef struct {
+    _Alignas(64) uint32_t head; // Next slot to consume, written by the consumer only
+    _Alignas(64) uint32_t tail; // Next slot to fill, written by the producer only
+    uint64_t dropped; // Reservations refused because the ring was full, written by the producer only
+    _Alignas(64) char *slots;
+    size_t slot_size;
+    uint32_t mask; // Capacity - 1; capacity is a power of two
+} SpscRing;
+
+int ring_init(SpscRing *ring, uint32_t capacity, size_t slot_size);
+void ring_free(SpscRing *ring);
+void *ring_reserve(SpscRing *ring);
+void ring_commit(SpscRing *ring);
+void *ring_peek(SpscRing *ring);
+void ring_release(SpscRing *ring);
+int ring_empty(SpscRing *ring);
+uint64_t ring_dropped(SpscRing *ring);
+
+#endif // RING_H
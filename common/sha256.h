@@ -0,0 +1,22 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+// Incremental SHA-256 (FIPS 180-4) state
+typedef struct {
+    uint32_t state[8];
+    uint64_t length; // Bytes hashed so far
+    uint8_t block[64]; // Partial block awaiting more input
+    size_t used; // Bytes in block
+} Sha256;
+
+void sha256_init(Sha256 *ctx);
+void sha256_update(Sha256 *ctx, const void *data, size_t size);
+void sha256_final(Sha256 *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+void sha256(const void *data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#endif // SHA256_H
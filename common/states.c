@@ -1,10 +1,10 @@
 #include "states.h"
-#include <stdio.h>
+#include "log.h"
 
 State current_state;
 
 void handle_transition(State new_state) {
-    printf("Transitioning from %d to %d\n", current_state, new_state);
+    LOG_DEBUG("Transitioning from %d to %d", current_state, new_state);
     current_state = new_state;
     // Additional logic for entering new state
     switch (new_state) {
@@ -0,0 +1,123 @@
+#include "xxh64.h"
+#include <string.h>
+
+#define XXH_PRIME1 0x9e3779b185ebca87ULL
+#define XXH_PRIME2 0xc2b2ae3d27d4eb4fULL
+#define XXH_PRIME3 0x165667b19e3779f9ULL
+#define XXH_PRIME4 0x85ebca77c2b2ae63ULL
+#define XXH_PRIME5 0x27d4eb2f165667c5ULL
+
+#define ROTL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+static uint64_t xxh_read64(const uint8_t *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t xxh_read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME2;
+    acc = ROTL64(acc, 31);
+    return acc * XXH_PRIME1;
+}
+
+static uint64_t xxh_merge(uint64_t hash, uint64_t acc) {
+    hash ^= xxh_round(0, acc);
+    return hash * XXH_PRIME1 + XXH_PRIME4;
+}
+
+// Function to fold one 32-byte stripe into the four lanes
+static void xxh_stripe(uint64_t acc[4], const uint8_t *p) {
+    acc[0] = xxh_round(acc[0], xxh_read64(p));
+    acc[1] = xxh_round(acc[1], xxh_read64(p + 8));
+    acc[2] = xxh_round(acc[2], xxh_read64(p + 16));
+    acc[3] = xxh_round(acc[3], xxh_read64(p + 24));
+}
+
+void xxh64_init(Xxh64 *ctx, uint64_t seed) {
+    ctx->acc[0] = seed + XXH_PRIME1 + XXH_PRIME2;
+    ctx->acc[1] = seed + XXH_PRIME2;
+    ctx->acc[2] = seed;
+    ctx->acc[3] = seed - XXH_PRIME1;
+    ctx->seed = seed;
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+void xxh64_update(Xxh64 *ctx, const void *data, size_t size) {
+    const uint8_t *p = data;
+    ctx->length += size;
+    if (ctx->used > 0) {
+        size_t take = sizeof(ctx->stripe) - ctx->used < size ? sizeof(ctx->stripe) - ctx->used : size;
+        memcpy(ctx->stripe + ctx->used, p, take);
+        ctx->used += take;
+        p += take;
+        size -= take;
+        if (ctx->used < sizeof(ctx->stripe)) {
+            return;
+        }
+        xxh_stripe(ctx->acc, ctx->stripe);
+        ctx->used = 0;
+    }
+    while (size >= sizeof(ctx->stripe)) {
+        xxh_stripe(ctx->acc, p);
+        p += sizeof(ctx->stripe);
+        size -= sizeof(ctx->stripe);
+    }
+    memcpy(ctx->stripe, p, size);
+    ctx->used = size;
+}
+
+// Function to finish the hash; the state is left as is, so more data may still be added
+uint64_t xxh64_final(const Xxh64 *ctx) {
+    uint64_t hash;
+    if (ctx->length >= sizeof(ctx->stripe)) {
+        hash = ROTL64(ctx->acc[0], 1) + ROTL64(ctx->acc[1], 7) + ROTL64(ctx->acc[2], 12) + ROTL64(ctx->acc[3], 18);
+        for (int i = 0; i < 4; i++) {
+            hash = xxh_merge(hash, ctx->acc[i]);
+        }
+    } else {
+        hash = ctx->seed + XXH_PRIME5;
+    }
+    hash += ctx->length;
+
+    // Fold in the bytes left over from the last full stripe
+    const uint8_t *p = ctx->stripe;
+    size_t size = ctx->used;
+    while (size >= 8) {
+        hash ^= xxh_round(0, xxh_read64(p));
+        hash = ROTL64(hash, 27) * XXH_PRIME1 + XXH_PRIME4;
+        p += 8;
+        size -= 8;
+    }
+    if (size >= 4) {
+        hash ^= (uint64_t)xxh_read32(p) * XXH_PRIME1;
+        hash = ROTL64(hash, 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+        size -= 4;
+    }
+    while (size-- > 0) {
+        hash ^= *p++ * XXH_PRIME5;
+        hash = ROTL64(hash, 11) * XXH_PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t xxh64(const void *data, size_t size, uint64_t seed) {
+    Xxh64 ctx;
+    xxh64_init(&ctx, seed);
+    xxh64_update(&ctx, data, size);
+    return xxh64_final(&ctx);
+}
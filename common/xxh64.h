@@ -0,0 +1,22 @@
+#ifndef XXH64_H
+#define XXH64_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Incremental XXH64 state: a fast non-cryptographic 64-bit hash for detecting corruption,
+// computed over a stream in any number of pieces
+typedef struct {
+    uint64_t acc[4]; // Lane accumulators
+    uint64_t seed;
+    uint64_t length; // Bytes hashed so far
+    uint8_t stripe[32]; // Partial stripe awaiting more input
+    size_t used; // Bytes in stripe
+} Xxh64;
+
+void xxh64_init(Xxh64 *ctx, uint64_t seed);
+void xxh64_update(Xxh64 *ctx, const void *data, size_t size);
+uint64_t xxh64_final(const Xxh64 *ctx);
+uint64_t xxh64(const void *data, size_t size, uint64_t seed);
+
+#endif // XXH64_H
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+#include "chunk_store.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "chunk.h"
+#include "sha256.h"
+
+// Initial number of index slots; the index grows once it is half full
+#define CHUNK_STORE_MIN_CAPACITY 1024
+
+// Length of a chunk's file name: two hex digits per hash byte
+#define CHUNK_NAME_LENGTH (2 * CP_CHUNK_HASH_SIZE)
+
+// Function to spell a chunk hash as the lowercase hex name of its file
+static void chunk_name(const uint8_t *hash, char name[CHUNK_NAME_LENGTH + 1]) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < CP_CHUNK_HASH_SIZE; i++) {
+        name[2 * i] = digits[hash[i] >> 4];
+        name[2 * i + 1] = digits[hash[i] & 0xf];
+    }
+    name[CHUNK_NAME_LENGTH] = '\0';
+}
+
+// Function to parse a chunk file name back into its hash; returns -1 for any other file
+static int chunk_parse_name(const char *name, uint8_t *hash) {
+    if (strlen(name) != CHUNK_NAME_LENGTH) {
+        return -1;
+    }
+    for (int i = 0; i < CHUNK_NAME_LENGTH; i++) {
+        char c = name[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (digit < 0) {
+            return -1;
+        }
+        hash[i / 2] = (i % 2) ? (hash[i / 2] | digit) : (uint8_t)(digit << 4);
+    }
+    return 0;
+}
+
+// Function to find the slot holding a hash, or the empty slot where it would go. The hash is
+// already uniformly distributed, so its first bytes serve as the slot index.
+static StoredChunk *chunk_store_slot(ChunkStore *store, const uint8_t *hash) {
+    uint32_t mask = store->capacity - 1;
+    uint32_t slot;
+    memcpy(&slot, hash, sizeof(slot));
+    slot &= mask;
+    while (store->slots[slot].length != 0 && memcmp(store->slots[slot].hash, hash, CP_CHUNK_HASH_SIZE) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    return &store->slots[slot];
+}
+
+// Function to add a chunk to the index, doubling it first when half full. Called with the lock held.
+static void chunk_store_insert(ChunkStore *store, const uint8_t *hash, uint32_t length) {
+    if ((store->count + 1) * 2 > store->capacity) {
+        StoredChunk *old_slots = store->slots;
+        uint32_t old_capacity = store->capacity;
+        StoredChunk *slots = calloc(old_capacity * 2, sizeof(*slots));
+        if (slots != NULL) {
+            store->slots = slots;
+            store->capacity = old_capacity * 2;
+            for (uint32_t i = 0; i < old_capacity; i++) {
+                if (old_slots[i].length != 0) {
+                    *chunk_store_slot(store, old_slots[i].hash) = old_slots[i];
+                }
+            }
+            free(old_slots);
+        } else if (store->count + 1 == store->capacity) {
+            return; // Keep one slot empty so probes terminate; the chunk just stays unindexed
+        }
+    }
+    StoredChunk *entry = chunk_store_slot(store, hash);
+    if (entry->length == 0) {
+        memcpy(entry->hash, hash, CP_CHUNK_HASH_SIZE);
+        entry->length = length;
+        store->count++;
+    }
+}
+
+// Function to open (creating if needed) the chunk directory and index the chunks already in it
+int chunk_store_open(ChunkStore *store, const char *path) {
+    memset(store, 0, sizeof(*store));
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    store->dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (store->dirfd < 0) {
+        return -1;
+    }
+    store->slots = calloc(CHUNK_STORE_MIN_CAPACITY, sizeof(*store->slots));
+    if (store->slots == NULL) {
+        close(store->dirfd);
+        return -1;
+    }
+    store->capacity = CHUNK_STORE_MIN_CAPACITY;
+    pthread_mutex_init(&store->lock, NULL);
+
+    // Leftover temporary files and anything else that is not a chunk are skipped
+    DIR *dir = fdopendir(dup(store->dirfd));
+    if (dir == NULL) {
+        return 0;
+    }
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL) {
+        uint8_t hash[CP_CHUNK_HASH_SIZE];
+        struct stat st;
+        if (chunk_parse_name(dirent->d_name, hash) == 0 && fstatat(store->dirfd, dirent->d_name, &st, 0) == 0 &&
+            S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size <= CHUNK_MAX_SIZE) {
+            chunk_store_insert(store, hash, st.st_size);
+        }
+    }
+    closedir(dir);
+    return 0;
+}
+
+void chunk_store_close(ChunkStore *store) {
+    if (store->slots != NULL) {
+        free(store->slots);
+        close(store->dirfd);
+        pthread_mutex_destroy(&store->lock);
+    }
+    memset(store, 0, sizeof(*store));
+}
+
+// Function to check whether the store holds a chunk with this hash and length
+int chunk_store_contains(ChunkStore *store, const uint8_t *hash, uint32_t length) {
+    pthread_mutex_lock(&store->lock);
+    int found = chunk_store_slot(store, hash)->length == length;
+    pthread_mutex_unlock(&store->lock);
+    return found;
+}
+
+// Function to copy length bytes between two files, letting the kernel share extents where the
+// filesystem supports it and falling back to reading and writing
+static int chunk_copy(int in_fd, uint64_t in_offset, int out_fd, uint64_t out_offset, uint32_t length) {
+    loff_t in_pos = in_offset;
+    loff_t out_pos = out_offset;
+    uint32_t remaining = length;
+    while (remaining > 0) {
+        ssize_t n = copy_file_range(in_fd, &in_pos, out_fd, &out_pos, remaining, 0);
+        if (n <= 0) {
+            break;
+        }
+        remaining -= n;
+    }
+    if (remaining == 0) {
+        return 0;
+    }
+
+    char buffer[CHUNK_MAX_SIZE];
+    if (pread(in_fd, buffer, remaining, in_pos) != (ssize_t)remaining ||
+        pwrite(out_fd, buffer, remaining, out_pos) != (ssize_t)remaining) {
+        return -1;
+    }
+    return 0;
+}
+
+// Function to write a stored chunk into a file at the given offset
+int chunk_store_read(ChunkStore *store, const uint8_t *hash, uint32_t length, int fd, uint64_t offset) {
+    char name[CHUNK_NAME_LENGTH + 1];
+    chunk_name(hash, name);
+    int chunk_fd = openat(store->dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (chunk_fd < 0) {
+        return -1;
+    }
+    int result = chunk_copy(chunk_fd, 0, fd, offset, length);
+    close(chunk_fd);
+    return result;
+}
+
+// Function to store the chunk at offset in a received file. The bytes are hashed first, so a
+// client cannot plant content under another chunk's name. Returns 1 if the chunk was added, 0 if
+// it was already stored and -1 if its contents do not match the hash or it could not be written.
+int chunk_store_add(ChunkStore *store, const uint8_t *hash, int fd, uint64_t offset, uint32_t length) {
+    if (length == 0 || length > CHUNK_MAX_SIZE) {
+        return -1;
+    }
+    if (chunk_store_contains(store, hash, length)) {
+        return 0;
+    }
+
+    char buffer[CHUNK_MAX_SIZE];
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    if (pread(fd, buffer, length, offset) != (ssize_t)length) {
+        return -1;
+    }
+    sha256(buffer, length, digest);
+    if (memcmp(digest, hash, CP_CHUNK_HASH_SIZE) != 0) {
+        return -1;
+    }
+
+    // Write under a temporary name and rename, so a chunk file is either complete or absent
+    char name[CHUNK_NAME_LENGTH + 1];
+    char temp_name[CHUNK_NAME_LENGTH + 32];
+    chunk_name(hash, name);
+    snprintf(temp_name, sizeof(temp_name), "%s.%ld.tmp", name, (long)gettid());
+    int chunk_fd = openat(store->dirfd, temp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (chunk_fd < 0) {
+        return -1;
+    }
+    int failed = pwrite(chunk_fd, buffer, length, 0) != (ssize_t)length;
+    if (close(chunk_fd) < 0 || failed || renameat(store->dirfd, temp_name, store->dirfd, name) < 0) {
+        unlinkat(store->dirfd, temp_name, 0);
+        return -1;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    chunk_store_insert(store, hash, length);
+    pthread_mutex_unlock(&store->lock);
+    return 1;
+}
@@ -0,0 +1,30 @@
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "message.h"
+
+// Chunk held by the store: its file is named by the hex SHA-256 of its contents
+typedef struct {
+    uint8_t hash[CP_CHUNK_HASH_SIZE];
+    uint32_t length; // 0 marks an empty slot
+} StoredChunk;
+
+// Deduplicated chunk directory shared by every worker, with an in-memory open-addressing hash
+// index (linear probing) of the chunks in it. The index is rebuilt from the directory at startup.
+typedef struct {
+    int dirfd; // Chunk directory
+    pthread_mutex_t lock; // Protects the index
+    StoredChunk *slots;
+    uint32_t capacity; // Power of two
+    uint32_t count;
+} ChunkStore;
+
+int chunk_store_open(ChunkStore *store, const char *path);
+void chunk_store_close(ChunkStore *store);
+int chunk_store_contains(ChunkStore *store, const uint8_t *hash, uint32_t length);
+int chunk_store_read(ChunkStore *store, const uint8_t *hash, uint32_t length, int fd, uint64_t offset);
+int chunk_store_add(ChunkStore *store, const uint8_t *hash, int fd, uint64_t offset, uint32_t length);
+
+#endif // CHUNK_STORE_H
@@ -0,0 +1,127 @@
+#define _GNU_SOURCE
+#include "pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define POOL_CACHE_LINE 64
+#define POOL_HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+// Function to map the backing region, preferring explicit huge pages when requested and
+// falling back to regular pages (with a transparent huge page hint) when none are reserved
+static int pool_map(PacketPool *pool, size_t size, int hugepages) {
+    pool->hugepages = 0;
+    if (hugepages) {
+        size_t huge_size = (size + POOL_HUGE_PAGE_SIZE - 1) & ~(POOL_HUGE_PAGE_SIZE - 1);
+        void *base = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED) {
+            pool->base = base;
+            pool->region_size = huge_size;
+            pool->hugepages = 1;
+            return 0;
+        }
+    }
+
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    if (hugepages) {
+        madvise(base, size, MADV_HUGEPAGE);
+    }
+    pool->base = base;
+    pool->region_size = size;
+    return 0;
+}
+
+// Function to allocate count buffers of at least buffer_size bytes, all initially free
+int pool_init(PacketPool *pool, uint32_t count, size_t buffer_size, int hugepages) {
+    memset(pool, 0, sizeof(*pool));
+    pool->buffer_size = (buffer_size + POOL_CACHE_LINE - 1) & ~(size_t)(POOL_CACHE_LINE - 1);
+    pool->count = count;
+    pool->free_list = malloc(count * sizeof(*pool->free_list));
+    if (pool->free_list == NULL) {
+        return -1;
+    }
+    if (pool_map(pool, (size_t)count * pool->buffer_size, hugepages) < 0) {
+        free(pool->free_list);
+        pool->free_list = NULL;
+        return -1;
+    }
+
+    // Lowest addresses on top so a lightly loaded server keeps touching the same pages
+    for (uint32_t i = 0; i < count; i++) {
+        pool->free_list[i] = pool->base + (size_t)(count - 1 - i) * pool->buffer_size;
+    }
+    pool->free_count = count;
+    pthread_mutex_init(&pool->lock, NULL);
+    return 0;
+}
+
+void pool_free(PacketPool *pool) {
+    if (pool->base != NULL) {
+        munmap(pool->base, pool->region_size);
+        pthread_mutex_destroy(&pool->lock);
+    }
+    free(pool->free_list);
+    memset(pool, 0, sizeof(*pool));
+}
+
+void pool_cache_init(PoolCache *cache, PacketPool *pool) {
+    cache->pool = pool;
+    cache->count = 0;
+}
+
+// Function to return every cached buffer to the pool
+void pool_cache_flush(PoolCache *cache) {
+    PacketPool *pool = cache->pool;
+    pthread_mutex_lock(&pool->lock);
+    while (cache->count > 0) {
+        pool->free_list[pool->free_count++] = cache->buffers[--cache->count];
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Function to take a buffer, refilling the cache from the pool when it is empty.
+// Returns NULL (and counts the failure) when the whole pool is in use.
+char *pool_get(PoolCache *cache) {
+    if (cache->count == 0) {
+        PacketPool *pool = cache->pool;
+        pthread_mutex_lock(&pool->lock);
+        while (cache->count < POOL_CACHE_BATCH && pool->free_count > 0) {
+            cache->buffers[cache->count++] = pool->free_list[--pool->free_count];
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if (cache->count == 0) {
+            __atomic_fetch_add(&pool->exhausted, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    }
+    return cache->buffers[--cache->count];
+}
+
+// Function to give a buffer back, spilling half of the cache to the pool when it is full.
+// Buffers may be returned by a different thread than the one that took them.
+void pool_put(PoolCache *cache, char *buffer) {
+    if (cache->count == POOL_CACHE_SIZE) {
+        PacketPool *pool = cache->pool;
+        pthread_mutex_lock(&pool->lock);
+        while (cache->count > POOL_CACHE_SIZE - POOL_CACHE_BATCH) {
+            pool->free_list[pool->free_count++] = cache->buffers[--cache->count];
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    cache->buffers[cache->count++] = buffer;
+}
+
+// Function to count buffers held by threads (queued packets and per-thread caches)
+uint32_t pool_in_use(PacketPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    uint32_t in_use = pool->count - pool->free_count;
+    pthread_mutex_unlock(&pool->lock);
+    return in_use;
+}
+
+uint64_t pool_exhausted(PacketPool *pool) {
+    return __atomic_load_n(&pool->exhausted, __ATOMIC_RELAXED);
+}
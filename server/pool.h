@@ -0,0 +1,44 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Buffers a thread keeps cached before returning them to the pool
+#define POOL_CACHE_SIZE 64
+// Buffers moved between a cache and the pool at once
+#define POOL_CACHE_BATCH (POOL_CACHE_SIZE / 2)
+
+// Preallocated pool of fixed-size packet buffers carved out of one region. Every buffer starts
+// on its own cache line. Threads allocate through a PoolCache and only take the pool lock to
+// refill or spill their cache, one batch at a time.
+typedef struct {
+    char *base; // Backing region
+    size_t region_size;
+    size_t buffer_size; // Rounded up to a multiple of the cache line size
+    uint32_t count; // Total number of buffers
+    int hugepages; // The region is backed by explicit huge pages
+    pthread_mutex_t lock; // Protects free_list and free_count
+    char **free_list; // Stack of buffers not held by any thread
+    uint32_t free_count;
+    uint64_t exhausted; // Allocations refused because every buffer was in use
+} PacketPool;
+
+// Per-thread cache of free buffers; only its owning thread touches it
+typedef struct {
+    PacketPool *pool;
+    char *buffers[POOL_CACHE_SIZE];
+    uint32_t count;
+} PoolCache;
+
+int pool_init(PacketPool *pool, uint32_t count, size_t buffer_size, int hugepages);
+void pool_free(PacketPool *pool);
+void pool_cache_init(PoolCache *cache, PacketPool *pool);
+void pool_cache_flush(PoolCache *cache);
+char *pool_get(PoolCache *cache);
+void pool_put(PoolCache *cache, char *buffer);
+uint32_t pool_in_use(PacketPool *pool);
+uint64_t pool_exhausted(PacketPool *pool);
+
+#endif // POOL_H
@@ -1,247 +1,2416 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/statvfs.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include <fcntl.h>
+#include <time.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
+#include <linux/filter.h>
 #include <errno.h>
+#include <pthread.h>
+#include <poll.h>
 #include <json-c/json.h>
 #include "message.h"
 #include "states.h"
+#include "uring.h"
+#include "session.h"
+#include "ring.h"
+#include "pool.h"
+#include "chunk.h"
+#include "compress.h"
+#include "crc32c.h"
+#include "log.h"
 
-// Maximum number of concurrent connections and file transfers
-#define MAX_CONN 1024
-#define MAX_FILE_ID 1000
+// Maximum number of concurrent client sessions per worker
+#define MAX_CONN 65536
 
-// Structure to handle file transfer details
+// Smallest datagram buffer (one text message) and default number of datagrams per batch
+#define PACKET_BUFFER_SIZE (MAX_MESSAGE_SIZE + sizeof(CP_Header))
+#define DEFAULT_BATCH_SIZE 32
+#define MAX_BATCH_SIZE 1024
+
+// Receive buffer size when UDP_GRO may coalesce a burst of datagrams into one buffer
+#define GRO_BUFFER_SIZE 65535
+// Ancillary data space for the UDP_GRO segment size
+#define RECV_CONTROL_SIZE CMSG_SPACE(sizeof(int))
+
+// Default and maximum number of worker threads sharing the port
+#define DEFAULT_WORKERS 1
+#define MAX_WORKERS 64
+
+// Maximum number of handler threads per worker and default depth of their rings
+#define MAX_HANDLERS 64
+#define DEFAULT_RING_DEPTH 1024
+
+// Default number of seconds after which an inactive transfer is closed
+#define DEFAULT_IDLE_TIMEOUT 60
+
+// Default number of in-order segments after which a SACK is sent before the batch ends
+#define DEFAULT_ACK_EVERY 32
+
+// Default cap on the negotiated segment payload; packet buffers are sized to hold one such segment
+#define DEFAULT_MAX_SEGMENT_SIZE CP_MAX_SEGMENT_SIZE
+// Default number of seconds between checkpoints of a transfer's received bitmap
+#define DEFAULT_CHECKPOINT_INTERVAL 5
+// Default directory of the deduplicated chunk store
+#define DEFAULT_CHUNK_DIR "chunks"
+
+// Identifies a transfer checkpoint file ("CPCK")
+#define CHECKPOINT_MAGIC 0x4b435043
+// File IDs tried for a new data file before giving up, skipping those whose file already exists
+#define DATA_FILE_ATTEMPTS 64
+
+// Full receive batches of the largest datagrams the socket receive buffer is sized for
+#define SOCKET_BUFFER_BATCHES 4
+
+// Maximum number of epoll events handled per wakeup
+#define MAX_EVENTS 16
+
+// io_uring backend sizing: submission entries, provided receive buffers and in-flight file writes
+#define URING_ENTRIES 256
+#define URING_RECV_BUFFERS 256
+#define URING_GRO_RECV_BUFFERS 64
+#define URING_WRITE_SLOTS 256
+#define URING_RECV_BGID 0
+
+// Operation kinds stored in the upper half of an io_uring user_data
+enum {
+    URING_OP_RECV = 1,
+    URING_OP_SEND,
+    URING_OP_WRITE,
+    URING_OP_IDLE_TIMER,
+    URING_OP_COMPLETION
+};
+#define URING_DATA(op, index) (((uint64_t)(op) << 32) | (uint32_t)(index))
+
+// Event sources registered with a worker's epoll instance
+typedef enum {
+    EVENT_SOCKET,
+    EVENT_IDLE_TIMER,
+    EVENT_COMPLETION
+} EventSource;
+
+// Server settings loaded from config/server_config.json
+typedef struct {
+    int port; // UDP port to listen on
+    int batch_size; // Datagrams received per recvmmsg and sent per sendmmsg
+    int workers; // Number of worker threads, each with its own SO_REUSEPORT socket
+    int client_affinity; // Steer each client to a fixed worker with a reuseport BPF program
+    int idle_timeout; // Seconds of inactivity after which a transfer is closed
+    int ack_every; // Segments after which a SACK is sent without waiting for the end of the batch
+    int max_segment_size; // Largest segment payload a transfer may negotiate
+    int checkpoint_interval; // Seconds between checkpoints of an upload's progress (0 only on close)
+    int use_uring; // Use the io_uring backend instead of epoll ("io_backend": "io_uring")
+    int gro; // Enable UDP_GRO so bursts of equal-size datagrams arrive in one buffer
+    int handlers; // Handler threads per worker (0 handles messages on the receive thread)
+    int ring_depth; // Packets each handler ring can hold in either direction
+    int pool_buffers; // Packet buffers per worker pool (0 sizes the pool from the settings above)
+    int hugepages; // Back the packet buffer pools with huge pages when available
+    char chunk_dir[256]; // Directory of the deduplicated chunk store; empty disables deduplication
+    int verify; // Read completed uploads back and check them against the client's whole-file hash
+    LogLevel log_level; // Most verbose level written to the log
+    int log_sample; // Record one in log_sample debug messages per call site
+} ServerConfig;
+
+// Datagrams received together with a single recvmmsg call
+typedef struct {
+    struct mmsghdr *msgs;
+    struct iovec *iovecs;
+    struct sockaddr_in *addrs;
+    char **buffers; // One per slot: a pool buffer, or a slice of gro_buffers
+    char *gro_buffers; // size * buffer_size bytes when bursts exceed a pool buffer
+    size_t buffer_size; // One datagram, or a whole GRO-coalesced burst
+    char (*controls)[RECV_CONTROL_SIZE]; // Ancillary data carrying the UDP_GRO segment size
+    int size; // Number of slots in the batch
+} RecvBatch;
+
+// Outgoing datagrams queued while dispatching a batch, flushed with sendmmsg
+typedef struct {
+    int sockfd;
+    struct mmsghdr *msgs;
+    struct iovec *iovecs;
+    struct sockaddr_in *addrs;
+    char **buffers; // Pool buffers owned by the queued datagrams
+    PoolCache *cache; // Where sent buffers go back to
+    int size; // Number of slots in the batch
+    int count; // Number of datagrams currently queued
+    int head; // First queued datagram not yet accepted by the socket
+    uint64_t dropped; // Datagrams dropped because the socket stayed full
+} SendBatch;
+
+typedef struct Worker Worker;
+typedef struct Handler Handler;
+
+// Transfer owed a selective acknowledgment once the current batch has been dispatched. It is
+// found again by address and file ID, so a transfer closed in the meantime is simply skipped.
+typedef struct {
+    struct sockaddr_in addr;
+    uint32_t file_id;
+} PendingSack;
+
+// Progress of an upload, persisted as "<filename>.<upload token>.ckpt" next to its data file and
+// followed by the received bitmap, so the upload can be resumed after either side restarts. The
+// bitmap only lists segments whose writes had reached the disk when it was saved.
 typedef struct {
-    uint32_t file_id; // ID of the file being transferred
-    FILE *file; // Pointer to the file being transferred
-    uint64_t file_size; // Size of the file in bytes
-    uint32_t received_segments; // Number of segments received
-} FileTransfer;
+    uint32_t magic; // CHECKPOINT_MAGIC
+    uint32_t file_id; // The data file is "<file_id>_<filename>"
+    uint64_t upload_token;
+    uint64_t file_size;
+    uint16_t segment_size;
+    uint32_t total_segments; // Followed by (total_segments + 63) / 64 bitmap words
+} TransferCheckpoint;
+
+// State used by the message handlers: the sessions they own and where their replies go.
+// A worker handling messages on its receive thread has one shard; with a handler pool each
+// handler thread owns one. File IDs are interleaved across shards: a shard assigns
+// file_id_base, file_id_base + file_id_stride, file_id_base + 2 * file_id_stride, ...
+typedef struct {
+    SessionTable sessions; // Clients served by this shard, keyed by address
+    uint32_t next_file_seq; // Sequence number of the next file ID this shard assigns, starting at random
+    uint32_t file_id_base;
+    uint32_t file_id_stride;
+    int idle_timeout;
+    PendingSack *pending_sacks; // Transfers that received segments during the current batch
+    int pending_sack_count;
+    int pending_sack_capacity;
+    char *inflate_buffer; // Decompressed segment data, max_segment_size bytes allocated on first use
+    Worker *worker; // Worker whose socket the shard's clients use
+    Handler *handler; // Handler thread owning the shard, or NULL on the receive thread
+} Shard;
+
+// Datagram passed between a worker and a handler thread through their rings
+typedef struct {
+    struct sockaddr_in addr; // Sender for inbound packets, destination for replies
+    uint16_t length;
+    char *data; // Pool buffer of PACKET_BUFFER_SIZE bytes, owned by whoever holds the packet
+} Packet;
+
+// Handler thread fed by its worker's receive thread. Packets from one client always go to the
+// same handler, so each handler's shard stays private to it.
+struct Handler {
+    int index;
+    pthread_t thread;
+    Shard shard;
+    SpscRing inbound; // Packets from the worker's receive thread
+    SpscRing outbound; // Replies for the worker to send
+    PoolCache cache; // Buffers of consumed packets and for replies, from the worker's pool
+    int wake_fd; // eventfd used to wake the handler when it sleeps on an empty ring
+    int sleeping; // Set while the handler is about to block on wake_fd
+    int replies_pending; // Replies were queued since the worker was last notified
+    uint64_t reported_drops; // Overflow total at the last report
+};
+
+// Worker thread owning one SO_REUSEPORT socket and, unless a handler pool is configured,
+// the sessions of the clients steered to it
+struct Worker {
+    int index; // Position of this worker in the reuseport group
+    int count; // Total number of workers
+    int sockfd; // Non-blocking UDP socket
+    int epollfd; // Reactor multiplexing the socket, timers and completions
+    int idle_timerfd; // Periodic timer for closing inactive transfers
+    int completion_fd; // eventfd signalled when work finished elsewhere needs attention
+    int idle_timeout;
+    int ack_every; // Segments after which a SACK goes out before the end of the batch
+    int max_segment_size; // Largest segment payload a transfer may negotiate
+    int checkpoint_interval; // Seconds between checkpoints of an upload's progress (0 only on close)
+    ChunkStore *chunk_store; // Shared by all workers, NULL when deduplication is disabled
+    Verifier *verifier; // Shared by all workers, NULL when verification is disabled
+    StripeTable *stripe_table; // First stripes of striped uploads, shared by all workers
+    int want_write; // Whether EPOLLOUT is currently armed on the socket
+    int gro; // UDP_GRO is enabled on the socket
+    pthread_t thread;
+    RecvBatch in;
+    SendBatch out;
+    // io_uring backend state
+    int use_uring;
+    Uring ring;
+    UringBufRing recv_bufs; // Provided buffers for multishot recvmsg
+    struct msghdr recv_msg; // Layout template for multishot recvmsg results
+    SendBatch out_inflight; // Replies submitted to the ring, reused once all sends complete
+    int sends_inflight;
+    char *write_bufs; // Copies of segment data owned by in-flight writes, max_segment_size bytes each
+    FileTransfer **write_owners; // Transfer each in-flight write slot belongs to
+    uint32_t *write_segments; // Segment each in-flight write slot carries, marked once written in full
+    uint16_t *write_sizes;
+    int *write_free; // Stack of free write slots
+    int write_free_count;
+    uint64_t timer_value; // Read target for the idle timerfd
+    uint64_t completion_value; // Read target for the completion eventfd
+    PacketPool pool; // Buffers shared by the receive path, handler rings and send batches
+    PoolCache cache; // The worker thread's share of the pool
+    uint64_t reported_exhausted; // Pool allocation failures at the last report
+    Shard shard; // Sessions handled on the receive thread when there are no handlers
+    Handler *handlers; // Handler pool; packets are steered by client address
+    int handler_count;
+};
+
+// Function declarations for handling different types of messages
+void handle_file_transfer_request(Shard *shard, Session *session, const CP_FileTransferRequestView *request);
+void handle_file_segment(Shard *shard, Session *session, const CP_FileSegmentView *segment);
+void handle_file_segment_ack(Shard *shard, Session *session, const CP_FileSegmentAckView *ack);
+void handle_file_transfer_complete(Shard *shard, Session *session, const CP_FileTransferCompleteView *complete);
+void handle_chunk_manifest(Shard *shard, Session *session, const CP_ChunkManifestView *manifest);
+void worker_notify(Worker *worker);
+static void shard_flush_sacks(Shard *shard);
+static void transfer_segment_written(Shard *shard, Session *session, FileTransfer *transfer, uint32_t segment_number);
+
+// Function to read a string setting, keeping the default when the key is absent
+static const char *config_get_string(struct json_object *parsed_json, const char *key, const char *default_value) {
+    struct json_object *value;
+    if (parsed_json == NULL || !json_object_object_get_ex(parsed_json, key, &value)) {
+        return default_value;
+    }
+    return json_object_get_string(value);
+}
+
+// Function to read an integer setting, keeping the default when the key is absent
+static int config_get_int(struct json_object *parsed_json, const char *key, int default_value) {
+    struct json_object *value;
+    if (parsed_json == NULL || !json_object_object_get_ex(parsed_json, key, &value)) {
+        return default_value;
+    }
+    return json_object_get_int(value);
+}
+
+// Function to read server configuration from a JSON file
+void read_server_config(const char *filename, ServerConfig *config) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        LOG_ERROR("Failed to open server configuration file: %s", strerror(errno));
+        handle_transition(ERROR);
+        exit(EXIT_FAILURE);
+    }
+
+    struct json_object *parsed_json;
+
+    char buffer[1024];
+    size_t n = fread(buffer, 1, sizeof(buffer) - 1, file);
+    buffer[n] = '\0';
+    fclose(file);
+
+    parsed_json = json_tokener_parse(buffer);
+    config->port = config_get_int(parsed_json, "port", config->port);
+    config->batch_size = config_get_int(parsed_json, "batch_size", config->batch_size);
+    config->workers = config_get_int(parsed_json, "workers", config->workers);
+    config->client_affinity = config_get_int(parsed_json, "client_affinity", config->client_affinity);
+    config->idle_timeout = config_get_int(parsed_json, "idle_timeout", config->idle_timeout);
+    config->ack_every = config_get_int(parsed_json, "ack_every", config->ack_every);
+    config->max_segment_size = config_get_int(parsed_json, "max_segment_size", config->max_segment_size);
+    config->checkpoint_interval = config_get_int(parsed_json, "checkpoint_interval", config->checkpoint_interval);
+    config->use_uring = strcmp(config_get_string(parsed_json, "io_backend", "epoll"), "io_uring") == 0;
+    config->gro = config_get_int(parsed_json, "gro", config->gro);
+    config->handlers = config_get_int(parsed_json, "handlers", config->handlers);
+    config->ring_depth = config_get_int(parsed_json, "ring_depth", config->ring_depth);
+    config->pool_buffers = config_get_int(parsed_json, "pool_buffers", config->pool_buffers);
+    config->hugepages = config_get_int(parsed_json, "hugepages", config->hugepages);
+    const char *chunk_dir = config_get_string(parsed_json, "chunk_dir", NULL);
+    if (chunk_dir != NULL) {
+        snprintf(config->chunk_dir, sizeof(config->chunk_dir), "%s", chunk_dir);
+    }
+    config->verify = config_get_int(parsed_json, "verify", config->verify);
+    config->log_level = log_level_from_string(config_get_string(parsed_json, "log_level", NULL), config->log_level);
+    config->log_sample = config_get_int(parsed_json, "log_sample", config->log_sample);
+    json_object_put(parsed_json);
+
+    // Keep the batch size within sane bounds
+    if (config->batch_size < 1) {
+        config->batch_size = 1;
+    } else if (config->batch_size > MAX_BATCH_SIZE) {
+        config->batch_size = MAX_BATCH_SIZE;
+    }
+    if (config->workers < 1) {
+        config->workers = 1;
+    } else if (config->workers > MAX_WORKERS) {
+        config->workers = MAX_WORKERS;
+    }
+    if (config->idle_timeout < 1) {
+        config->idle_timeout = 1;
+    }
+    if (config->ack_every < 1) {
+        config->ack_every = 1;
+    }
+    if (config->max_segment_size < FILE_SEGMENT_SIZE) {
+        config->max_segment_size = FILE_SEGMENT_SIZE;
+    } else if (config->max_segment_size > CP_MAX_SEGMENT_SIZE) {
+        config->max_segment_size = CP_MAX_SEGMENT_SIZE;
+    }
+    if (config->checkpoint_interval < 0) {
+        config->checkpoint_interval = 0;
+    }
+    if (config->handlers < 0) {
+        config->handlers = 0;
+    } else if (config->handlers > MAX_HANDLERS) {
+        config->handlers = MAX_HANDLERS;
+    }
+    if (config->ring_depth < 1) {
+        config->ring_depth = 1;
+    }
+    if (config->log_sample < 1) {
+        config->log_sample = 1;
+    }
+    if (config->pool_buffers < 0) {
+        config->pool_buffers = 0;
+    }
+}
+
+// Function to read the monotonic clock in seconds
+static time_t now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+// Function to allocate a receive batch with one buffer of buffer_size bytes per slot. Datagram-sized
+// slots take their buffers from the pool so a received packet can be handed on without a copy.
+static void recv_batch_init(RecvBatch *batch, int size, size_t buffer_size, PoolCache *cache) {
+    batch->size = size;
+    batch->buffer_size = buffer_size;
+    batch->msgs = calloc(size, sizeof(*batch->msgs));
+    batch->iovecs = calloc(size, sizeof(*batch->iovecs));
+    batch->addrs = calloc(size, sizeof(*batch->addrs));
+    batch->buffers = calloc(size, sizeof(*batch->buffers));
+    batch->controls = calloc(size, sizeof(*batch->controls));
+    batch->gro_buffers = buffer_size > cache->pool->buffer_size ? calloc(size, buffer_size) : NULL;
+    if (!batch->msgs || !batch->iovecs || !batch->addrs || !batch->buffers || !batch->controls ||
+        (buffer_size > cache->pool->buffer_size && !batch->gro_buffers)) {
+        perror("Failed to allocate receive batch");
+        handle_transition(ERROR);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < size; i++) {
+        batch->buffers[i] = batch->gro_buffers ? batch->gro_buffers + i * buffer_size : pool_get(cache);
+        if (batch->buffers[i] == NULL) {
+            LOG_ERROR("Packet buffer pool too small for a receive batch of %d", size);
+            handle_transition(ERROR);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Function to receive up to batch->size datagrams that are already queued on the socket
+static int recv_batch(int sockfd, RecvBatch *batch) {
+    for (int i = 0; i < batch->size; i++) {
+        batch->iovecs[i].iov_base = batch->buffers[i];
+        batch->iovecs[i].iov_len = batch->buffer_size;
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iovecs[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+        batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+        batch->msgs[i].msg_hdr.msg_control = batch->controls[i];
+        batch->msgs[i].msg_hdr.msg_controllen = sizeof(batch->controls[i]);
+        batch->msgs[i].msg_len = 0;
+    }
+    return recvmmsg(sockfd, batch->msgs, batch->size, MSG_DONTWAIT, NULL);
+}
+
+// Function to allocate a send batch for the given socket; datagram buffers come from cache
+static void send_batch_init(SendBatch *batch, int sockfd, int size, PoolCache *cache) {
+    batch->sockfd = sockfd;
+    batch->cache = cache;
+    batch->size = size;
+    batch->count = 0;
+    batch->head = 0;
+    batch->dropped = 0;
+    batch->msgs = calloc(size, sizeof(*batch->msgs));
+    batch->iovecs = calloc(size, sizeof(*batch->iovecs));
+    batch->addrs = calloc(size, sizeof(*batch->addrs));
+    batch->buffers = calloc(size, sizeof(*batch->buffers));
+    if (!batch->msgs || !batch->iovecs || !batch->addrs || !batch->buffers) {
+        perror("Failed to allocate send batch");
+        handle_transition(ERROR);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Function to release the buffers of every queued datagram and empty the batch
+static void send_batch_reset(SendBatch *batch) {
+    for (int i = 0; i < batch->count; i++) {
+        pool_put(batch->cache, batch->buffers[i]);
+    }
+    batch->count = 0;
+    batch->head = 0;
+}
+
+// Function to send queued datagrams with as few sendmmsg calls as possible. A datagram the kernel
+// refuses is counted as dropped and the rest are still sent. Returns the number of datagrams still
+// pending because the socket buffer is full.
+static int send_batch_flush(SendBatch *batch) {
+    while (batch->head < batch->count) {
+        int n = sendmmsg(batch->sockfd, batch->msgs + batch->head, batch->count - batch->head, MSG_CONFIRM | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return batch->count - batch->head;
+            }
+            // The error belongs to the datagram at head; drop it and send the ones behind it
+            perror("sendmmsg failed");
+            batch->head++;
+            batch->dropped++;
+            continue;
+        }
+        batch->head += n;
+    }
+    send_batch_reset(batch);
+    return 0;
+}
+
+// Function to queue a pool buffer holding a datagram for the next flush, flushing first if the
+// batch is full. The batch owns the buffer from here on.
+static void send_batch_push(SendBatch *batch, const struct sockaddr_in *addr, socklen_t len, char *buffer, size_t size) {
+    if (batch->count == batch->size && send_batch_flush(batch) > 0) {
+        batch->dropped++;
+        pool_put(batch->cache, buffer);
+        return;
+    }
+
+    int i = batch->count++;
+    batch->buffers[i] = buffer;
+    memcpy(&batch->addrs[i], addr, sizeof(*addr));
+    batch->iovecs[i].iov_base = batch->buffers[i];
+    batch->iovecs[i].iov_len = size;
+    batch->msgs[i].msg_hdr.msg_iov = &batch->iovecs[i];
+    batch->msgs[i].msg_hdr.msg_iovlen = 1;
+    batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+    batch->msgs[i].msg_hdr.msg_namelen = len;
+    batch->msgs[i].msg_hdr.msg_control = NULL;
+    batch->msgs[i].msg_hdr.msg_controllen = 0;
+}
+
+// Function to copy a datagram into a pool buffer and queue it for the next flush
+static void send_batch_queue(SendBatch *batch, const struct sockaddr_in *addr, socklen_t len, const void *data, size_t size) {
+    if (size > batch->cache->pool->buffer_size) {
+        LOG_WARN("Outgoing datagram too large: %zu bytes", size);
+        return;
+    }
+    char *buffer = pool_get(batch->cache);
+    if (buffer == NULL) {
+        batch->dropped++;
+        return;
+    }
+    memcpy(buffer, data, size);
+    send_batch_push(batch, addr, len, buffer, size);
+}
+
+// Function to queue a reply to a session's client: straight into the worker's send batch on the
+// receive thread, or through the handler's outbound ring (overflow is counted and dropped)
+static void session_reply(Shard *shard, Session *session, const void *data, size_t size) {
+    session->packets_sent++;
+    if (shard->handler == NULL) {
+        send_batch_queue(&shard->worker->out, &session->addr, sizeof(session->addr), data, size);
+        return;
+    }
+
+    Packet *packet = ring_reserve(&shard->handler->outbound);
+    if (packet == NULL) {
+        return;
+    }
+    packet->data = pool_get(&shard->handler->cache);
+    if (packet->data == NULL) {
+        return; // Pool exhausted: counted by the pool
+    }
+    packet->addr = session->addr;
+    packet->length = size;
+    memcpy(packet->data, data, size);
+    ring_commit(&shard->handler->outbound);
+    shard->handler->replies_pending = 1;
+}
+
+// Function to find the session of the datagram's sender, creating one for new clients
+static Session *shard_session(Shard *shard, struct sockaddr_in *cliaddr, time_t now) {
+    Session *session = session_lookup(&shard->sessions, cliaddr);
+    if (session != NULL) {
+        return session;
+    }
+    if (shard->sessions.count >= MAX_CONN) {
+        LOG_WARN("Maximum number of sessions reached");
+        return NULL;
+    }
+    session = session_create(&shard->sessions, cliaddr, now);
+    if (session == NULL) {
+        perror("Failed to create session");
+        return NULL;
+    }
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &cliaddr->sin_addr, ip, sizeof(ip));
+    LOG_INFO("New session: %s:%u", ip, ntohs(cliaddr->sin_port));
+    return session;
+}
+
+// Function to dispatch a single received datagram to its message handler. Handlers get views
+// that point into buffer, so nothing is copied out of the receive buffer.
+static void dispatch_packet(Shard *shard, struct sockaddr_in *cliaddr, char *buffer, int n) {
+    CP_TextMessageView text_message;
+    CP_FileTransferRequestView file_request;
+    CP_FileSegmentView file_segment;
+    CP_FileSegmentAckView file_ack;
+    CP_FileTransferCompleteView file_complete;
+    CP_PathProbeView path_probe;
+    CP_ChunkManifestView chunk_manifest;
+    uint8_t codecs;
+
+    LOG_DEBUG("Received %d bytes", n);
+
+    // Every datagram is attributed to its sender's session in O(1)
+    time_t now = now_seconds();
+    Session *session = shard_session(shard, cliaddr, now);
+    if (session == NULL) {
+        return;
+    }
+    session->last_activity = now;
+    session->packets_received++;
+    session->bytes_received += n;
+
+    // Handle different types of messages based on the header type
+    int type = view_message_type(buffer, n);
+    int valid = 0;
+    switch (type) {
+        case CP_TEXT_MESSAGE: // Text Message
+            valid = view_text_message(buffer, n, &text_message) == 0;
+            // The echo goes back as received, so a compressed message is echoed compressed
+            if (valid && text_message.codec != CP_CODEC_NONE) {
+                LOG_DEBUG("Received %s-compressed message: %u bytes", codec_name(text_message.codec), text_message.length);
+                session_reply(shard, session, buffer, n);
+            } else if (valid) {
+                LOG_DEBUG("Received message: %.*s", (int)text_message.length, text_message.content);
+                session_reply(shard, session, buffer, n);
+            }
+            break;
+        case CP_FILE_TRANSFER_REQUEST: // File Transfer Request
+            valid = view_file_transfer_request(buffer, n, &file_request) == 0;
+            if (valid) {
+                handle_file_transfer_request(shard, session, &file_request);
+            }
+            break;
+        case CP_FILE_SEGMENT: // File Segment
+            valid = view_file_segment(buffer, n, &file_segment) == 0;
+            if (valid) {
+                handle_file_segment(shard, session, &file_segment);
+            }
+            break;
+        case CP_FILE_SEGMENT_ACK: // File Segment Ack
+            valid = view_file_segment_ack(buffer, n, &file_ack) == 0;
+            if (valid) {
+                handle_file_segment_ack(shard, session, &file_ack);
+            }
+            break;
+        case CP_FILE_TRANSFER_COMPLETE: // File Transfer Complete
+            valid = view_file_transfer_complete(buffer, n, &file_complete) == 0;
+            if (valid) {
+                handle_file_transfer_complete(shard, session, &file_complete);
+            }
+            break;
+        case CP_CHUNK_MANIFEST: // Chunk Manifest
+            valid = view_chunk_manifest(buffer, n, &chunk_manifest) == 0;
+            if (valid) {
+                handle_chunk_manifest(shard, session, &chunk_manifest);
+            }
+            break;
+        case CP_SESSION_HELLO: // Session Hello
+            valid = view_session_hello(buffer, n, &codecs) == 0;
+            // Confirm the codecs the client offered that this server can decode
+            if (valid) {
+                CP_SessionHello hello;
+                encode_session_hello(&hello, codecs & codec_supported());
+                session_reply(shard, session, &hello, sizeof(hello));
+            }
+            break;
+        case CP_PATH_PROBE: // Path MTU Probe
+            valid = view_path_probe(buffer, n, &path_probe) == 0;
+            // Report how much arrived: a probe larger than the receive buffer is truncated
+            if (valid) {
+                CP_PathProbeAck probe_ack;
+                encode_path_probe_ack(&probe_ack, path_probe.probe_size, n);
+                session_reply(shard, session, &probe_ack, sizeof(probe_ack));
+            }
+            break;
+        default:
+            if (type >= 0) {
+                LOG_WARN("Unknown message type: %d", type);
+                handle_transition(ERROR);
+                return;
+            }
+            break; // Shorter than a header
+    }
+    if (!valid) {
+        LOG_WARN("Malformed message of type %d: %d bytes", type, n);
+        handle_transition(ERROR);
+    }
+}
+
+// Function to extract the UDP_GRO segment size from a received message, or 0 if not coalesced
+static int recv_gso_size(struct msghdr *msg) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int gso_size;
+            memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+            return gso_size;
+        }
+    }
+    return 0;
+}
+
+// Function to hand a received datagram to the handler that owns its sender (chosen by address
+// hash, so a client always lands on the same handler), or dispatch it inline without a pool.
+// When slot is the pool buffer holding the datagram, the buffer itself moves to the handler and
+// the slot is refilled; otherwise the datagram is copied into a fresh pool buffer.
+static void worker_deliver(Worker *worker, struct sockaddr_in *cliaddr, char *buffer, int n, char **slot) {
+    if (worker->handler_count == 0) {
+        dispatch_packet(&worker->shard, cliaddr, buffer, n);
+        return;
+    }
+    // Truncate like a datagram-sized receive buffer would; only GRO buffers hold more
+    if (n > (int)worker->pool.buffer_size) {
+        LOG_DEBUG("Truncating oversized datagram: %d bytes", n);
+        n = worker->pool.buffer_size;
+    }
+
+    Handler *handler = &worker->handlers[session_hash(cliaddr) % worker->handler_count];
+    Packet *packet = ring_reserve(&handler->inbound);
+    if (packet == NULL) {
+        return; // Ring full: counted as an overflow, never blocks the receive thread
+    }
+    char *fresh = pool_get(&worker->cache);
+    if (fresh == NULL) {
+        return; // Pool exhausted: counted by the pool
+    }
+    if (slot != NULL) {
+        packet->data = *slot;
+        *slot = fresh;
+    } else {
+        memcpy(fresh, buffer, n);
+        packet->data = fresh;
+    }
+    packet->addr = *cliaddr;
+    packet->length = n;
+    ring_commit(&handler->inbound);
+
+    // Wake the handler only if it went to sleep on an empty ring
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&handler->sleeping, 0, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        if (write(handler->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("Failed to wake handler");
+        }
+    }
+}
+
+// Function to queue every reply the handlers produced into the worker's send batch
+static void worker_collect_replies(Worker *worker) {
+    for (int i = 0; i < worker->handler_count; i++) {
+        Packet *packet;
+        while ((packet = ring_peek(&worker->handlers[i].outbound)) != NULL) {
+            send_batch_push(&worker->out, &packet->addr, sizeof(packet->addr), packet->data, packet->length);
+            ring_release(&worker->handlers[i].outbound);
+        }
+    }
+}
+
+// Function to split a buffer holding GRO-coalesced datagrams of gso_size bytes each
+// (the last one may be shorter) and dispatch every datagram individually. slot is passed on
+// to worker_deliver when the buffer is a pool buffer holding a single datagram.
+static void dispatch_buffer(Worker *worker, struct sockaddr_in *cliaddr, char *buffer, int n, int gso_size, char **slot) {
+    if (gso_size <= 0 || gso_size >= n) {
+        worker_deliver(worker, cliaddr, buffer, n, slot);
+        return;
+    }
+    for (int offset = 0; offset < n; offset += gso_size) {
+        int size = n - offset < gso_size ? n - offset : gso_size;
+        worker_deliver(worker, cliaddr, buffer + offset, size, NULL);
+    }
+}
+
+// Function to create a UDP socket bound to the server port with SO_REUSEPORT set
+static int create_worker_socket(int port) {
+    int sockfd;
+    struct sockaddr_in servaddr;
+    int one = 1;
+
+    // Create a socket for communication
+    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("Socket creation failed");
+        return -1;
+    }
+
+    // Allow every worker to bind its own socket to the same port
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        perror("Failed to set SO_REUSEPORT");
+        close(sockfd);
+        return -1;
+    }
+
+    // Initialize server address structure
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = INADDR_ANY;
+    servaddr.sin_port = htons(port);
+
+    // Bind the socket to the server address
+    if (bind(sockfd, (const struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
+        perror("Bind failed");
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+// Function to attach a classic BPF program to the reuseport group that maps each client
+// (source address and port) to a fixed worker. The socket index in the group is the
+// order in which the sockets were bound, which is the worker index.
+static int attach_client_affinity(int sockfd, int workers) {
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_NET_OFF + 12 }, // A = IPv4 source address
+        { BPF_MISC | BPF_TAX, 0, 0, 0 },                     // X = A
+        { BPF_LD | BPF_H | BPF_ABS, 0, 0, SKF_NET_OFF + 20 }, // A = UDP source port (no IP options)
+        { BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0 },              // A ^= X
+        { BPF_ALU | BPF_MUL | BPF_K, 0, 0, 0x9E3779B1 },     // Mix the bits
+        { BPF_ALU | BPF_RSH | BPF_K, 0, 0, 16 },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)workers }, // A = worker index
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog = {
+        .len = sizeof(code) / sizeof(code[0]),
+        .filter = code,
+    };
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        perror("Failed to attach reuseport steering program");
+        return -1;
+    }
+    return 0;
+}
+
+// Function to register a file descriptor with the worker's epoll instance
+static int worker_watch(Worker *worker, int fd, EventSource source, uint32_t events) {
+    struct epoll_event ev = {
+        .events = events,
+        .data.u32 = source,
+    };
+    return epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// Function to create the worker's idle timer and completion eventfd
+static int worker_timers_init(Worker *worker, int timer_flags, int event_flags) {
+    worker->idle_timerfd = timerfd_create(CLOCK_MONOTONIC, timer_flags | TFD_CLOEXEC);
+    worker->completion_fd = eventfd(0, event_flags | EFD_CLOEXEC);
+    if (worker->idle_timerfd < 0 || worker->completion_fd < 0) {
+        perror("Failed to create timer descriptors");
+        return -1;
+    }
+
+    // Sweep for idle transfers twice per timeout period
+    int interval = worker->idle_timeout > 1 ? worker->idle_timeout / 2 : 1;
+    struct itimerspec its = {
+        .it_interval = { .tv_sec = interval },
+        .it_value = { .tv_sec = interval },
+    };
+    if (timerfd_settime(worker->idle_timerfd, 0, &its, NULL) < 0) {
+        perror("Failed to arm idle timer");
+        return -1;
+    }
+    return 0;
+}
+
+// Function to create the worker's epoll instance, idle timer and completion eventfd
+static int worker_reactor_init(Worker *worker, int idle_timeout) {
+    worker->idle_timeout = idle_timeout;
+    worker->want_write = 0;
+
+    // Switch the socket to non-blocking mode; readiness comes from epoll
+    int flags = fcntl(worker->sockfd, F_GETFL, 0);
+    if (flags < 0 || fcntl(worker->sockfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("Failed to make socket non-blocking");
+        return -1;
+    }
+
+    worker->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (worker->epollfd < 0) {
+        perror("Failed to create epoll instance");
+        return -1;
+    }
+    if (worker_timers_init(worker, TFD_NONBLOCK, EFD_NONBLOCK) < 0) {
+        return -1;
+    }
+
+    if (worker_watch(worker, worker->sockfd, EVENT_SOCKET, EPOLLIN) < 0 ||
+        worker_watch(worker, worker->idle_timerfd, EVENT_IDLE_TIMER, EPOLLIN) < 0 ||
+        worker_watch(worker, worker->completion_fd, EVENT_COMPLETION, EPOLLIN) < 0) {
+        perror("Failed to register reactor descriptors");
+        return -1;
+    }
+    return 0;
+}
+
+// Function to wake a worker's reactor from another thread
+void worker_notify(Worker *worker) {
+    uint64_t one = 1;
+    if (write(worker->completion_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("Failed to signal worker");
+    }
+}
+
+// Function to arm or disarm EPOLLOUT depending on whether replies are still pending
+static void worker_update_write_interest(Worker *worker, int pending) {
+    int want_write = pending > 0;
+    if (want_write == worker->want_write) {
+        return;
+    }
+    struct epoll_event ev = {
+        .events = EPOLLIN | (want_write ? EPOLLOUT : 0),
+        .data.u32 = EVENT_SOCKET,
+    };
+    if (epoll_ctl(worker->epollfd, EPOLL_CTL_MOD, worker->sockfd, &ev) == 0) {
+        worker->want_write = want_write;
+    }
+}
+
+// Function to receive and dispatch every datagram queued on the socket
+static void worker_drain_socket(Worker *worker) {
+    while (1) {
+        // Receive a batch of messages from clients
+        int count = recv_batch(worker->sockfd, &worker->in);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                handle_transition(ERROR);
+            }
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            struct msghdr *msg = &worker->in.msgs[i].msg_hdr;
+            int n = worker->in.msgs[i].msg_len;
+            if (n > 0) {
+                char **slot = worker->in.gro_buffers ? NULL : &worker->in.buffers[i];
+                dispatch_buffer(worker, &worker->in.addrs[i], msg->msg_iov->iov_base, n, worker->gro ? recv_gso_size(msg) : 0, slot);
+            } else {
+                handle_transition(ERROR);
+            }
+        }
+        shard_flush_sacks(&worker->shard);
+
+        // A partial batch means the socket queue is empty
+        if (count < worker->in.size) {
+            break;
+        }
+    }
+}
+
+// Serializes checkpoint writes and removals across workers. A transfer resuming an upload may
+// take it over while the interrupted transfer is still open elsewhere, and the two must never
+// replace each other's checkpoint.
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Function to read which file ID the checkpoint at path belongs to, or 0 when there is none
+static uint32_t checkpoint_owner(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    TransferCheckpoint checkpoint;
+    uint32_t file_id = 0;
+    if (fread(&checkpoint, sizeof(checkpoint), 1, file) == 1 && checkpoint.magic == CHECKPOINT_MAGIC) {
+        file_id = checkpoint.file_id;
+    }
+    fclose(file);
+    return file_id;
+}
+
+// Function to persist a transfer's received bitmap. The data file is synced first, and segments
+// are only marked once their write completed, so the bitmap never claims data a crash could lose.
+// The checkpoint is written to a temporary file and renamed over the previous one, so a crash
+// midway leaves the older checkpoint intact. A transfer whose upload was resumed by another one
+// stops checkpointing.
+static void transfer_checkpoint(FileTransfer *transfer) {
+    if (transfer->checkpoint_path == NULL) {
+        return;
+    }
+    if (fdatasync(fileno(transfer->file)) < 0) {
+        perror("Failed to sync file before checkpoint");
+        return;
+    }
+    char temp_path[MAX_FILENAME_LENGTH + 40];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", transfer->checkpoint_path);
+    TransferCheckpoint checkpoint = {
+        .magic = CHECKPOINT_MAGIC,
+        .file_id = transfer->file_id,
+        .upload_token = transfer->upload_token,
+        .file_size = transfer->file_size,
+        .segment_size = transfer->segment_size,
+        .total_segments = transfer->total_segments,
+    };
+    size_t map_words = ((size_t)transfer->total_segments + 63) / 64;
+
+    pthread_mutex_lock(&checkpoint_lock);
+    if (checkpoint_owner(transfer->checkpoint_path) != transfer->checkpoint_file_id) {
+        pthread_mutex_unlock(&checkpoint_lock);
+        LOG_INFO("File ID %u was resumed by another transfer, leaving its checkpoint alone", transfer->file_id);
+        free(transfer->checkpoint_path);
+        transfer->checkpoint_path = NULL;
+        return;
+    }
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        pthread_mutex_unlock(&checkpoint_lock);
+        perror("Failed to create transfer checkpoint");
+        return;
+    }
+    int failed = fwrite(&checkpoint, sizeof(checkpoint), 1, file) != 1 ||
+                 fwrite(transfer->received_map, sizeof(uint64_t), map_words, file) != map_words;
+    if (fclose(file) != 0 || failed || rename(temp_path, transfer->checkpoint_path) < 0) {
+        perror("Failed to write transfer checkpoint");
+        unlink(temp_path);
+        pthread_mutex_unlock(&checkpoint_lock);
+        return;
+    }
+    transfer->checkpoint_file_id = transfer->file_id;
+    pthread_mutex_unlock(&checkpoint_lock);
+    transfer->last_checkpoint = now_seconds();
+    transfer->checkpointed_count = transfer->received_count;
+}
+
+// Function to remove the checkpoint of a completed upload, unless another transfer has taken it over
+static void transfer_remove_checkpoint(FileTransfer *transfer) {
+    pthread_mutex_lock(&checkpoint_lock);
+    if (checkpoint_owner(transfer->checkpoint_path) == transfer->checkpoint_file_id) {
+        unlink(transfer->checkpoint_path);
+    }
+    pthread_mutex_unlock(&checkpoint_lock);
+}
+
+// Function to delete the checkpoint of upload_token that a resume was refused from, along with
+// the data file it describes. The client is told the upload starts over, so neither could be
+// used again.
+static void checkpoint_discard(const char *path, const char *filename, uint64_t upload_token) {
+    pthread_mutex_lock(&checkpoint_lock);
+    FILE *file = fopen(path, "rb");
+    TransferCheckpoint checkpoint;
+    if (file != NULL && fread(&checkpoint, sizeof(checkpoint), 1, file) == 1 &&
+        checkpoint.magic == CHECKPOINT_MAGIC && checkpoint.upload_token == upload_token) {
+        char data_path[MAX_FILENAME_LENGTH + 16];
+        snprintf(data_path, sizeof(data_path), "%u_%s", checkpoint.file_id, filename);
+        unlink(data_path);
+        unlink(path);
+        LOG_INFO("Discarded the checkpoint and data file of an upload of %s that cannot be resumed", filename);
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    pthread_mutex_unlock(&checkpoint_lock);
+}
+
+// Function to load the checkpoint of the interrupted upload upload_token of a file of this name and
+// size. Returns its received bitmap, or NULL when there is no usable checkpoint.
+static uint64_t *checkpoint_load(const char *path, uint64_t file_size, uint64_t upload_token, uint16_t max_segment_size, TransferCheckpoint *checkpoint) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    uint64_t *map = NULL;
+    if (fread(checkpoint, sizeof(*checkpoint), 1, file) == 1 && checkpoint->magic == CHECKPOINT_MAGIC &&
+        checkpoint->upload_token == upload_token && checkpoint->file_size == file_size &&
+        checkpoint->segment_size > 0 && checkpoint->segment_size <= max_segment_size &&
+        checkpoint->total_segments == (file_size + checkpoint->segment_size - 1) / checkpoint->segment_size) {
+        size_t map_words = ((size_t)checkpoint->total_segments + 63) / 64;
+        map = calloc(map_words + 1, sizeof(uint64_t));
+        if (map != NULL && fread(map, sizeof(uint64_t), map_words, file) != map_words) {
+            free(map);
+            map = NULL;
+        }
+    }
+    fclose(file);
+    return map;
+}
+
+// Function to add the chunks of a completed upload that were received rather than filled in from
+// the store, so later uploads of the same content can skip them
+static void transfer_store_chunks(FileTransfer *transfer) {
+    uint32_t added = 0;
+    uint32_t mismatched = 0;
+    uint64_t added_bytes = 0;
+    for (uint32_t i = 0; i < transfer->chunk_count; i++) {
+        TransferChunk *chunk = &transfer->chunks[i];
+        if (chunk->length == 0 || chunk->known) {
+            continue;
+        }
+        int result = chunk_store_add(transfer->chunk_store, chunk->hash, fileno(transfer->file), chunk->offset, chunk->length);
+        if (result > 0) {
+            added++;
+            added_bytes += chunk->length;
+        } else if (result < 0) {
+            mismatched++;
+        }
+    }
+    if (added > 0) {
+        LOG_INFO("Chunk store: %u chunks (%" PRIu64 " bytes) added from file ID %u", added, added_bytes, transfer->file_id);
+    }
+    if (mismatched > 0) {
+        LOG_WARN("Chunk store: %u chunks of file ID %u not stored (hash mismatch or write error)", mismatched, transfer->file_id);
+    }
+}
+
+// Function to close a transfer's file and release it, deferring while asynchronous writes are outstanding.
+// An incomplete upload leaves a final checkpoint behind to resume from; a complete one removes it,
+// adds its new chunks to the store and is queued to be checked against the client's hash.
+static void transfer_close(FileTransfer *transfer) {
+    // No further stripe may join an upload whose first stripe is closing
+    if (transfer->stripe_table != NULL) {
+        stripe_table_remove(transfer->stripe_table, transfer->file_id);
+        transfer->stripe_table = NULL;
+    }
+    if (transfer->writes_inflight > 0) {
+        transfer->closing = 1;
+        return;
+    }
+    if (transfer->received_count < transfer->total_segments) {
+        transfer_checkpoint(transfer);
+    } else {
+        if (transfer->checkpoint_path != NULL) {
+            transfer_remove_checkpoint(transfer);
+        }
+        if (transfer->chunk_store != NULL) {
+            transfer_store_chunks(transfer);
+        }
+        if (transfer->verifier != NULL &&
+            verifier_submit(transfer->verifier, fileno(transfer->file), transfer->stripe_offset, transfer->file_size, transfer->file_hash, transfer->file_id) < 0) {
+            perror("Failed to queue file verification");
+        }
+    }
+    fclose(transfer->file);
+    if (transfer->session != NULL) {
+        session_remove_transfer(transfer->session, transfer);
+    }
+    free(transfer->chunks);
+    free(transfer->name);
+    free(transfer->checkpoint_path);
+    free(transfer->received_map);
+    free(transfer);
+}
+
+// Function to close transfers and drop sessions that have been inactive for the idle timeout, and
+// checkpoint uploads that stalled with progress not yet saved
+static void shard_sweep_idle(Shard *shard) {
+    time_t now = now_seconds();
+    int interval = shard->worker->checkpoint_interval;
+    SessionTable *table = &shard->sessions;
+    uint32_t slot = 0;
+    while (slot < table->capacity) {
+        Session *session = table->slots[slot];
+        if (session == NULL) {
+            slot++;
+            continue;
+        }
+
+        // Iterate backwards: closing a transfer moves the last one into its place
+        for (int i = session->transfer_count - 1; i >= 0; i--) {
+            FileTransfer *transfer = session->transfers[i];
+            if (!transfer->closing && now - transfer->last_activity > shard->idle_timeout) {
+                LOG_INFO("File transfer timed out: ID %u", transfer->file_id);
+                transfer_close(transfer);
+            } else if (!transfer->closing && interval > 0 && transfer->received_count != transfer->checkpointed_count &&
+                       now - transfer->last_checkpoint >= interval) {
+                transfer_checkpoint(transfer);
+            }
+        }
+
+        if (session->transfer_count == 0 && now - session->last_activity > shard->idle_timeout) {
+            char ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &session->addr.sin_addr, ip, sizeof(ip));
+            LOG_INFO("Session closed: %s:%u (%" PRIu64 " packets in, %" PRIu64 " out)", ip, ntohs(session->addr.sin_port), session->packets_received, session->packets_sent);
+            uint32_t capacity = table->capacity;
+            session_remove(table, session);
+            // Removal shifts a later session into this slot; rescan it unless the table was resized
+            if (table->capacity != capacity) {
+                slot = 0;
+            }
+            continue;
+        }
+        slot++;
+    }
+}
+
+// Function to sweep the worker's own shard, report buffer pool occupancy and report handler ring
+// overflows and pool exhaustion since the last sweep
+static void worker_sweep_idle(Worker *worker) {
+    shard_sweep_idle(&worker->shard);
+
+    uint64_t exhausted = pool_exhausted(&worker->pool);
+    LOG_INFO("Worker %d buffer pool: %u of %u buffers in use", worker->index, pool_in_use(&worker->pool), worker->pool.count);
+    if (exhausted != worker->reported_exhausted) {
+        LOG_WARN("Worker %d buffer pool exhausted: %" PRIu64 " packets dropped", worker->index, exhausted - worker->reported_exhausted);
+        worker->reported_exhausted = exhausted;
+    }
+
+    for (int i = 0; i < worker->handler_count; i++) {
+        Handler *handler = &worker->handlers[i];
+        uint64_t drops = ring_dropped(&handler->inbound) + ring_dropped(&handler->outbound);
+        if (drops != handler->reported_drops) {
+            LOG_WARN("Handler %d ring overflow: %" PRIu64 " inbound, %" PRIu64 " outbound packets dropped",
+                   handler->index, ring_dropped(&handler->inbound), ring_dropped(&handler->outbound));
+            handler->reported_drops = drops;
+        }
+    }
+}
+
+// Function run by each handler thread: consume packets from the inbound ring, run the message
+// handlers on the handler's own shard and pass replies back through the outbound ring
+static void *handler_main(void *arg) {
+    Handler *handler = arg;
+    Worker *worker = handler->shard.worker;
+    int sweep_interval = handler->shard.idle_timeout > 1 ? handler->shard.idle_timeout / 2 : 1;
+    time_t next_sweep = now_seconds() + sweep_interval;
+
+    while (1) {
+        Packet *packet;
+        while ((packet = ring_peek(&handler->inbound)) != NULL) {
+            dispatch_packet(&handler->shard, &packet->addr, packet->data, packet->length);
+            pool_put(&handler->cache, packet->data);
+            ring_release(&handler->inbound);
+        }
+        shard_flush_sacks(&handler->shard);
+
+        // One wakeup per drained batch lets the worker send all replies together
+        if (handler->replies_pending) {
+            handler->replies_pending = 0;
+            worker_notify(worker);
+        }
+
+        time_t now = now_seconds();
+        if (now >= next_sweep) {
+            shard_sweep_idle(&handler->shard);
+            next_sweep = now + sweep_interval;
+        }
+
+        // Announce that we are going to sleep, then re-check so a concurrent push is not missed
+        __atomic_store_n(&handler->sleeping, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!ring_empty(&handler->inbound)) {
+            __atomic_store_n(&handler->sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        struct pollfd pfd = {
+            .fd = handler->wake_fd,
+            .events = POLLIN,
+        };
+        if (poll(&pfd, 1, sweep_interval * 1000) > 0) {
+            uint64_t value;
+            if (read(handler->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+                perror("Failed to read handler wakeup");
+            }
+        }
+        __atomic_store_n(&handler->sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    return NULL;
+}
+
+// Function to take the next file ID this shard owns, wrapping around at the end of the 32-bit
+// range. File ID 0 is never assigned.
+static uint32_t shard_next_file_id(Shard *shard) {
+    uint32_t file_id;
+    do {
+        if (shard->next_file_seq > (UINT32_MAX - shard->file_id_base) / shard->file_id_stride) {
+            shard->next_file_seq = 0;
+        }
+        file_id = shard->next_file_seq++ * shard->file_id_stride + shard->file_id_base;
+    } while (file_id == 0);
+    return file_id;
+}
+
+// Function to initialize a shard's session table and file ID sequence
+static void shard_init(Shard *shard, Worker *worker, Handler *handler, uint32_t file_id_base, uint32_t file_id_stride, int idle_timeout) {
+    session_table_init(&shard->sessions);
+    shard->file_id_base = file_id_base;
+    shard->file_id_stride = file_id_stride;
+    // Start at a random point of the sequence, so file IDs, which name the data files, are not
+    // handed out again after a restart
+    uint32_t seed;
+    if (getrandom(&seed, sizeof(seed), 0) != sizeof(seed)) {
+        seed = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+    }
+    shard->next_file_seq = seed % ((uint64_t)(UINT32_MAX - file_id_base) / file_id_stride + 1);
+    shard->idle_timeout = idle_timeout;
+    shard->pending_sacks = NULL;
+    shard->pending_sack_count = 0;
+    shard->pending_sack_capacity = 0;
+    shard->inflate_buffer = NULL;
+    shard->worker = worker;
+    shard->handler = handler;
+}
+
+// Function to create a worker's handler pool; each handler gets its own rings, wakeup eventfd and shard
+static int worker_handlers_init(Worker *worker, int handler_count, int ring_depth, int idle_timeout) {
+    worker->handler_count = handler_count;
+    if (handler_count == 0) {
+        return 0;
+    }
+    worker->handlers = calloc(handler_count, sizeof(Handler));
+    if (worker->handlers == NULL) {
+        perror("Failed to allocate handlers");
+        return -1;
+    }
+
+    for (int i = 0; i < handler_count; i++) {
+        Handler *handler = &worker->handlers[i];
+        handler->index = worker->index * handler_count + i;
+        if (ring_init(&handler->inbound, ring_depth, sizeof(Packet)) < 0 ||
+            ring_init(&handler->outbound, ring_depth, sizeof(Packet)) < 0) {
+            perror("Failed to allocate handler rings");
+            return -1;
+        }
+        pool_cache_init(&handler->cache, &worker->pool);
+        handler->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (handler->wake_fd < 0) {
+            perror("Failed to create handler eventfd");
+            return -1;
+        }
+        shard_init(&handler->shard, worker, handler, handler->index, worker->count * handler_count, idle_timeout);
+    }
+    return 0;
+}
+
+// Function run by each worker thread: an epoll reactor over the socket, idle timer and completions
+static void *worker_main(void *arg) {
+    Worker *worker = arg;
+    struct epoll_event events[MAX_EVENTS];
+    uint64_t expirations;
+
+    while (1) {
+        int n = epoll_wait(worker->epollfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno != EINTR) {
+                perror("epoll_wait failed");
+                handle_transition(ERROR);
+            }
+            continue;
+        }
+
+        for (int i = 0; i < n; i++) {
+            switch (events[i].data.u32) {
+                case EVENT_SOCKET:
+                    if (events[i].events & EPOLLIN) {
+                        worker_drain_socket(worker);
+                    }
+                    break;
+                case EVENT_IDLE_TIMER:
+                    if (read(worker->idle_timerfd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                        worker_sweep_idle(worker);
+                    }
+                    break;
+                case EVENT_COMPLETION:
+                    if (read(worker->completion_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+                        perror("Failed to read completion counter");
+                    }
+                    worker_collect_replies(worker);
+                    break;
+            }
+        }
+
+        // Send all echoes and acknowledgments produced by this wakeup at once
+        worker_update_write_interest(worker, send_batch_flush(&worker->out));
+    }
+
+    return NULL;
+}
+
+// Function to set up the io_uring backend: ring, provided receive buffers, write slots and timers.
+// Returns -1 if io_uring is unavailable so the caller can fall back to epoll.
+static int worker_uring_init(Worker *worker, int batch_size) {
+    if (uring_init(&worker->ring, URING_ENTRIES) < 0) {
+        perror("Failed to create io_uring");
+        return -1;
+    }
+
+    // Each provided buffer holds the recvmsg header, the peer address, the GRO ancillary data
+    // and either one datagram or a coalesced burst
+    memset(&worker->recv_msg, 0, sizeof(worker->recv_msg));
+    worker->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+    worker->recv_msg.msg_controllen = worker->gro ? RECV_CONTROL_SIZE : 0;
+    size_t payload_size = worker->gro ? GRO_BUFFER_SIZE : worker->pool.buffer_size;
+    unsigned entries = worker->gro ? URING_GRO_RECV_BUFFERS : URING_RECV_BUFFERS;
+    size_t buf_size = sizeof(struct io_uring_recvmsg_out) + worker->recv_msg.msg_namelen + worker->recv_msg.msg_controllen + payload_size;
+    if (uring_buf_ring_init(&worker->ring, &worker->recv_bufs, URING_RECV_BGID, entries, buf_size) < 0) {
+        perror("Failed to register io_uring receive buffers");
+        uring_close(&worker->ring);
+        return -1;
+    }
+
+    worker->write_bufs = calloc(URING_WRITE_SLOTS, worker->max_segment_size);
+    worker->write_owners = calloc(URING_WRITE_SLOTS, sizeof(*worker->write_owners));
+    worker->write_segments = calloc(URING_WRITE_SLOTS, sizeof(*worker->write_segments));
+    worker->write_sizes = calloc(URING_WRITE_SLOTS, sizeof(*worker->write_sizes));
+    worker->write_free = calloc(URING_WRITE_SLOTS, sizeof(*worker->write_free));
+    if (!worker->write_bufs || !worker->write_owners || !worker->write_segments || !worker->write_sizes || !worker->write_free) {
+        perror("Failed to allocate io_uring write slots");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < URING_WRITE_SLOTS; i++) {
+        worker->write_free[i] = URING_WRITE_SLOTS - 1 - i;
+    }
+    worker->write_free_count = URING_WRITE_SLOTS;
+
+    send_batch_init(&worker->out_inflight, worker->sockfd, batch_size, &worker->cache);
+    worker->sends_inflight = 0;
+
+    // Blocking descriptors: io_uring waits for readiness itself
+    if (worker_timers_init(worker, 0, 0) < 0) {
+        return -1;
+    }
+    worker->epollfd = -1;
+    worker->use_uring = 1;
+    return 0;
+}
+
+// Function to reserve a submission entry, submitting queued entries first if the ring is full
+static struct io_uring_sqe *worker_uring_sqe(Worker *worker) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&worker->ring);
+    while (sqe == NULL) {
+        uring_submit_and_wait(&worker->ring, 0);
+        sqe = uring_get_sqe(&worker->ring);
+    }
+    return sqe;
+}
+
+// Function to arm a multishot recvmsg that picks buffers from the provided buffer ring
+static void worker_uring_arm_recv(Worker *worker) {
+    struct io_uring_sqe *sqe = worker_uring_sqe(worker);
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = worker->sockfd;
+    sqe->addr = (uint64_t)(uintptr_t)&worker->recv_msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_RECV_BGID;
+    sqe->user_data = URING_DATA(URING_OP_RECV, 0);
+}
+
+// Function to queue an 8-byte read of a timerfd or eventfd
+static void worker_uring_arm_read(Worker *worker, int fd, uint64_t *value, int op) {
+    struct io_uring_sqe *sqe = worker_uring_sqe(worker);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)value;
+    sqe->len = sizeof(*value);
+    sqe->off = (uint64_t)-1; // Use the current file position
+    sqe->user_data = URING_DATA(op, 0);
+}
+
+// Function to submit every queued reply as one sendmsg per datagram in a single io_uring_enter.
+// Replies queued while a previous submission is in flight wait for it to complete.
+static void worker_uring_flush_replies(Worker *worker) {
+    if (worker->sends_inflight > 0 || worker->out.count == 0) {
+        return;
+    }
+
+    // Swap the filling batch with the idle one so handlers can keep queuing
+    SendBatch filled = worker->out;
+    worker->out = worker->out_inflight;
+    worker->out_inflight = filled;
+
+    for (int i = 0; i < worker->out_inflight.count; i++) {
+        struct io_uring_sqe *sqe = worker_uring_sqe(worker);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = worker->sockfd;
+        sqe->addr = (uint64_t)(uintptr_t)&worker->out_inflight.msgs[i].msg_hdr;
+        sqe->len = 1;
+        sqe->user_data = URING_DATA(URING_OP_SEND, i);
+    }
+    worker->sends_inflight = worker->out_inflight.count;
+}
 
-// Array to hold file transfer details
-FileTransfer file_transfers[MAX_FILE_ID];
+// Function to write a segment's data at the given file offset without blocking the loop.
+// The data is copied into a write slot that stays owned by the kernel until completion, and
+// the segment is only marked once that completion reports every byte written. Returns 1 when
+// queued, 0 when written synchronously because every slot was busy, and -1 on a failed write.
+static int worker_uring_write(Worker *worker, FileTransfer *transfer, uint32_t segment_number, const char *data, uint16_t size, uint64_t offset) {
+    if (worker->write_free_count == 0) {
+        // Every slot is busy: fall back to a synchronous positional write
+        if (pwrite(fileno(transfer->file), data, size, offset) != size) {
+            perror("Failed to write file segment");
+            return -1;
+        }
+        return 0;
+    }
 
-// Function declarations for handling different types of messages
-void handle_file_transfer_request(int sockfd, struct sockaddr_in *cliaddr, socklen_t len, CP_FileTransferRequest *request);
-void handle_file_segment(int sockfd, struct sockaddr_in *cliaddr, socklen_t len, CP_FileSegment *segment);
-void handle_file_segment_ack(int sockfd, struct sockaddr_in *cliaddr, socklen_t len, CP_FileSegmentAck *ack);
-void handle_file_transfer_complete(int sockfd, struct sockaddr_in *cliaddr, socklen_t len, CP_FileTransferComplete *complete);
+    int slot = worker->write_free[--worker->write_free_count];
+    char *copy = worker->write_bufs + (size_t)slot * worker->max_segment_size;
+    memcpy(copy, data, size);
+    worker->write_owners[slot] = transfer;
+    worker->write_segments[slot] = segment_number;
+    worker->write_sizes[slot] = size;
+    transfer->writes_inflight++;
 
-// Function to read server configuration from a JSON file
-void read_server_config(const char *filename, int *port) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        printf("Failed to open server configuration file: %s\n", strerror(errno));
-        handle_transition(ERROR);
-        exit(EXIT_FAILURE);
+    struct io_uring_sqe *sqe = worker_uring_sqe(worker);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fileno(transfer->file);
+    sqe->addr = (uint64_t)(uintptr_t)copy;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = URING_DATA(URING_OP_WRITE, slot);
+    return 1;
+}
+
+// Function to process one io_uring completion
+static void worker_uring_complete(Worker *worker, uint64_t user_data, int res, uint32_t flags) {
+    uint32_t index = (uint32_t)user_data;
+
+    switch (user_data >> 32) {
+        case URING_OP_RECV:
+            if (flags & IORING_CQE_F_BUFFER) {
+                uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+                char *buf = uring_buf_ring_get(&worker->recv_bufs, bid);
+                struct io_uring_recvmsg_out *msg_out = (struct io_uring_recvmsg_out *)buf;
+                char *name = buf + sizeof(*msg_out);
+                char *control = name + worker->recv_msg.msg_namelen;
+                char *payload = control + worker->recv_msg.msg_controllen;
+                // A datagram larger than the buffer arrives cut short; its sender will resend it
+                if (msg_out->flags & MSG_TRUNC) {
+                    LOG_WARN("Truncated datagram of %u bytes dropped", msg_out->payloadlen);
+                } else if (res > 0 && msg_out->payloadlen > 0) {
+                    // Wrap the ancillary data so the regular cmsg macros can walk it
+                    struct msghdr msg = {
+                        .msg_control = control,
+                        .msg_controllen = msg_out->controllen,
+                    };
+                    int gso_size = worker->gro ? recv_gso_size(&msg) : 0;
+                    dispatch_buffer(worker, (struct sockaddr_in *)name, payload, msg_out->payloadlen, gso_size, NULL);
+                }
+                uring_buf_ring_recycle(&worker->recv_bufs, bid);
+            } else if (res < 0 && res != -ENOBUFS) {
+                errno = -res;
+                perror("io_uring recvmsg failed");
+            }
+            // Multishot stops on errors and when buffers run out; re-arm it
+            if (!(flags & IORING_CQE_F_MORE)) {
+                worker_uring_arm_recv(worker);
+            }
+            break;
+        case URING_OP_SEND:
+            if (res < 0) {
+                errno = -res;
+                perror("io_uring sendmsg failed");
+            }
+            if (--worker->sends_inflight == 0) {
+                send_batch_reset(&worker->out_inflight);
+            }
+            break;
+        case URING_OP_WRITE: {
+            FileTransfer *transfer = worker->write_owners[index];
+            if (res == worker->write_sizes[index]) {
+                transfer_segment_written(&worker->shard, transfer->session, transfer, worker->write_segments[index]);
+            } else if (res < 0) {
+                errno = -res;
+                perror("Failed to write file segment");
+            } else {
+                // Left unmarked and unacknowledged, so the client sends the segment again
+                LOG_WARN("Short write of segment %u of file ID %u (%d of %u bytes)", worker->write_segments[index], transfer->file_id, res, worker->write_sizes[index]);
+            }
+            worker->write_free[worker->write_free_count++] = index;
+            if (--transfer->writes_inflight == 0 && transfer->closing) {
+                transfer_close(transfer);
+            }
+            break;
+        }
+        case URING_OP_IDLE_TIMER:
+            if (res == sizeof(worker->timer_value)) {
+                worker_sweep_idle(worker);
+            }
+            worker_uring_arm_read(worker, worker->idle_timerfd, &worker->timer_value, URING_OP_IDLE_TIMER);
+            break;
+        case URING_OP_COMPLETION:
+            worker_collect_replies(worker);
+            worker_uring_arm_read(worker, worker->completion_fd, &worker->completion_value, URING_OP_COMPLETION);
+            break;
     }
+}
 
-    struct json_object *parsed_json;
-    struct json_object *json_port;
+// Function run by each worker thread with the io_uring backend: network and disk I/O are
+// submitted and reaped in batches, one io_uring_enter per loop iteration
+static void *worker_main_uring(void *arg) {
+    Worker *worker = arg;
 
-    char buffer[256];
-    fread(buffer, sizeof(buffer), 1, file);
-    fclose(file);
+    worker_uring_arm_recv(worker);
+    worker_uring_arm_read(worker, worker->idle_timerfd, &worker->timer_value, URING_OP_IDLE_TIMER);
+    worker_uring_arm_read(worker, worker->completion_fd, &worker->completion_value, URING_OP_COMPLETION);
 
-    parsed_json = json_tokener_parse(buffer);
-    json_object_object_get_ex(parsed_json, "port", &json_port);
-    *port = json_object_get_int(json_port);
+    while (1) {
+        int ret = uring_submit_and_wait(&worker->ring, 1);
+        if (ret < 0 && ret != -EINTR && ret != -EBUSY && ret != -EAGAIN) {
+            errno = -ret;
+            perror("io_uring_enter failed");
+            handle_transition(ERROR);
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&worker->ring)) != NULL) {
+            uint64_t user_data = cqe->user_data;
+            int res = cqe->res;
+            uint32_t flags = cqe->flags;
+            uring_cqe_seen(&worker->ring);
+            worker_uring_complete(worker, user_data, res, flags);
+        }
+
+        // Submit all echoes and acknowledgments produced by this iteration at once
+        shard_flush_sacks(&worker->shard);
+        worker_uring_flush_replies(worker);
+    }
+
+    return NULL;
 }
 
 int main() {
-    int sockfd;
-    struct sockaddr_in servaddr, cliaddr;
-    socklen_t len;
-    char buffer[MAX_MESSAGE_SIZE + sizeof(CP_Header)];
-    CP_TextMessage text_message;
-    CP_FileTransferRequest file_request;
-    CP_FileSegment file_segment;
-    CP_FileSegmentAck file_ack;
-    CP_FileTransferComplete file_complete;
-    char decoded_message[MAX_MESSAGE_SIZE];
-
     // Initialize state to DISCONNECTED and transition to CONNECTING
     current_state = DISCONNECTED;
     handle_transition(CONNECTING);
 
-    // Default port for the server
-    int port = 4433;
-    // Read server configuration to get the port
-    read_server_config("config/server_config.json", &port);
+    // Default settings for the server
+    ServerConfig config = {
+        .port = 4433,
+        .batch_size = DEFAULT_BATCH_SIZE,
+        .workers = DEFAULT_WORKERS,
+        .client_affinity = 1,
+        .idle_timeout = DEFAULT_IDLE_TIMEOUT,
+        .ack_every = DEFAULT_ACK_EVERY,
+        .max_segment_size = DEFAULT_MAX_SEGMENT_SIZE,
+        .checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL,
+        .gro = 0,
+        .handlers = 0,
+        .ring_depth = DEFAULT_RING_DEPTH,
+        .pool_buffers = 0,
+        .hugepages = 0,
+        .chunk_dir = DEFAULT_CHUNK_DIR,
+        .verify = 1,
+        .log_level = LOG_LEVEL_INFO,
+        .log_sample = 1,
+    };
+    // Read server configuration to get the port, batch size, worker count and I/O backend
+    read_server_config("config/server_config.json", &config);
+    int port = config.port;
 
-    // Create a socket for communication
-    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-        perror("Socket creation failed");
+    // Every packet buffer holds the largest segment a transfer may negotiate
+    size_t packet_size = file_segment_wire_size(config.max_segment_size);
+    if (packet_size < PACKET_BUFFER_SIZE) {
+        packet_size = PACKET_BUFFER_SIZE;
+    }
+
+    // Move log formatting and output to a background thread
+    if (log_init(config.log_level, config.log_sample) < 0) {
+        perror("Failed to start log flusher");
+    }
+
+    // Index the chunk store once; every worker deduplicates against it
+    ChunkStore chunk_store;
+    int dedup = config.chunk_dir[0] != '\0';
+    if (dedup && chunk_store_open(&chunk_store, config.chunk_dir) < 0) {
+        LOG_WARN("Failed to open chunk store %s, deduplication disabled: %s", config.chunk_dir, strerror(errno));
+        dedup = 0;
+    } else if (dedup) {
+        LOG_INFO("Chunk store %s: %u chunks", config.chunk_dir, chunk_store.count);
+    }
+
+    // Completed uploads are read back and hashed on a thread of their own
+    Verifier verifier;
+    int verify = config.verify;
+    if (verify && verifier_start(&verifier) < 0) {
+        LOG_WARN("Failed to start verifier thread, uploads are not verified");
+        verify = 0;
+    }
+
+    // Later stripes of an upload are checked against its open first stripe on any worker
+    StripeTable stripe_table;
+    if (stripe_table_init(&stripe_table) < 0) {
+        perror("Failed to initialize stripe table");
         handle_transition(ERROR);
         exit(EXIT_FAILURE);
     }
 
-    // Initialize server address structure
-    memset(&servaddr, 0, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = INADDR_ANY;
-    servaddr.sin_port = htons(port);
-
-    // Bind the socket to the server address
-    if (bind(sockfd, (const struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
-        perror("Bind failed");
+    Worker *workers = calloc(config.workers, sizeof(Worker));
+    if (workers == NULL) {
+        perror("Failed to allocate workers");
         handle_transition(ERROR);
-        close(sockfd);
         exit(EXIT_FAILURE);
     }
 
+    // Bind every worker socket before any thread starts receiving
+    for (int i = 0; i < config.workers; i++) {
+        Worker *worker = &workers[i];
+        worker->index = i;
+        worker->count = config.workers;
+        worker->sockfd = create_worker_socket(port);
+        if (worker->sockfd < 0) {
+            handle_transition(ERROR);
+            exit(EXIT_FAILURE);
+        }
+
+        // Let the socket queue a few full batches of the largest segments before dropping
+        int rcvbuf = SOCKET_BUFFER_BATCHES * config.batch_size * (int)packet_size;
+        if (setsockopt(worker->sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0 &&
+            setsockopt(worker->sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0) {
+            perror("Failed to set SO_RCVBUF");
+        }
+
+        // Let the kernel coalesce bursts of equal-size datagrams from the same client
+        if (config.gro) {
+            int one = 1;
+            if (setsockopt(worker->sockfd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0) {
+                worker->gro = 1;
+            } else {
+                perror("Failed to enable UDP_GRO");
+            }
+        }
+
+        // Size the packet buffer pool for the worst case: a full receive batch, both send batches,
+        // full rings in both directions for every handler and a full cache on every thread
+        uint32_t pool_buffers = config.pool_buffers;
+        if (pool_buffers == 0) {
+            pool_buffers = 3 * config.batch_size + 2 * config.handlers * config.ring_depth + (config.handlers + 1) * POOL_CACHE_SIZE;
+        }
+        if (pool_init(&worker->pool, pool_buffers, packet_size, config.hugepages) < 0) {
+            perror("Failed to allocate packet buffer pool");
+            handle_transition(ERROR);
+            exit(EXIT_FAILURE);
+        }
+        if (config.hugepages && !worker->pool.hugepages) {
+            LOG_WARN("No huge pages reserved, packet buffers use regular pages");
+        }
+        pool_cache_init(&worker->cache, &worker->pool);
+
+        // Allocate the receive and send batches
+        recv_batch_init(&worker->in, config.batch_size, worker->gro ? GRO_BUFFER_SIZE : packet_size, &worker->cache);
+        send_batch_init(&worker->out, worker->sockfd, config.batch_size, &worker->cache);
+
+        // Set up the worker's event loop, preferring io_uring when configured and available
+        worker->idle_timeout = config.idle_timeout;
+        worker->ack_every = config.ack_every;
+        worker->max_segment_size = config.max_segment_size;
+        worker->checkpoint_interval = config.checkpoint_interval;
+        worker->chunk_store = dedup ? &chunk_store : NULL;
+        worker->verifier = verify ? &verifier : NULL;
+        worker->stripe_table = &stripe_table;
+        if (config.use_uring && worker_uring_init(worker, config.batch_size) < 0) {
+            LOG_WARN("io_uring unavailable, falling back to epoll");
+        }
+        if (!worker->use_uring && worker_reactor_init(worker, config.idle_timeout) < 0) {
+            handle_transition(ERROR);
+            exit(EXIT_FAILURE);
+        }
+
+        // Sessions live on the receive thread, or are spread over the worker's handler pool
+        shard_init(&worker->shard, worker, NULL, i, config.workers, config.idle_timeout);
+        if (worker_handlers_init(worker, config.handlers, config.ring_depth, config.idle_timeout) < 0) {
+            handle_transition(ERROR);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Pin each client to one worker so its sessions and transfers never move between threads
+    if (config.workers > 1 && config.client_affinity) {
+        if (attach_client_affinity(workers[0].sockfd, config.workers) < 0) {
+            LOG_WARN("Falling back to kernel reuseport hashing");
+        }
+    }
+
     // Transition to CONNECTED state and start listening for messages
     handle_transition(CONNECTED);
-    printf("Server listening on port %d\n", port);
+    LOG_INFO("Server listening on port %d (workers %d, handlers per worker %d, batch size %d)", port, config.workers, config.handlers, config.batch_size);
 
-    while (1) {
-        len = sizeof(cliaddr);
-        // Receive a message from a client
-        int n = recvfrom(sockfd, buffer, sizeof(buffer), MSG_WAITALL, (struct sockaddr *)&cliaddr, &len);
-        if (n > 0) {
-            printf("Received %d bytes\n", n);
-            CP_Header *header = (CP_Header *)buffer;
-            // Handle different types of messages based on the header type
-            switch (header->type) {
-                case CP_TEXT_MESSAGE: // Text Message
-                    memcpy(&text_message, buffer, sizeof(text_message));
-                    decode_text_message(&text_message, decoded_message);
-                    printf("Received message: %s\n", decoded_message);
-                    sendto(sockfd, buffer, n, MSG_CONFIRM, (const struct sockaddr *)&cliaddr, len);
-                    break;
-                case CP_FILE_TRANSFER_REQUEST: // File Transfer Request
-                    memcpy(&file_request, buffer, sizeof(file_request));
-                    handle_file_transfer_request(sockfd, &cliaddr, len, &file_request);
-                    break;
-                case CP_FILE_SEGMENT: // File Segment
-                    memcpy(&file_segment, buffer, sizeof(file_segment));
-                    handle_file_segment(sockfd, &cliaddr, len, &file_segment);
-                    break;
-                case CP_FILE_SEGMENT_ACK: // File Segment Ack
-                    memcpy(&file_ack, buffer, sizeof(file_ack));
-                    handle_file_segment_ack(sockfd, &cliaddr, len, &file_ack);
-                    break;
-                case CP_FILE_TRANSFER_COMPLETE: // File Transfer Complete
-                    memcpy(&file_complete, buffer, sizeof(file_complete));
-                    handle_file_transfer_complete(sockfd, &cliaddr, len, &file_complete);
-                    break;
-                default:
-                    printf("Unknown message type: %d\n", header->type);
-                    handle_transition(ERROR);
-                    break;
+    for (int i = 0; i < config.workers; i++) {
+        for (int j = 0; j < workers[i].handler_count; j++) {
+            if (pthread_create(&workers[i].handlers[j].thread, NULL, handler_main, &workers[i].handlers[j]) != 0) {
+                perror("Failed to start handler thread");
+                handle_transition(ERROR);
+                exit(EXIT_FAILURE);
             }
-        } else {
+        }
+        void *(*loop)(void *) = workers[i].use_uring ? worker_main_uring : worker_main;
+        if (pthread_create(&workers[i].thread, NULL, loop, &workers[i]) != 0) {
+            perror("Failed to start worker thread");
             handle_transition(ERROR);
+            exit(EXIT_FAILURE);
         }
     }
 
-    // Transition to DISCONNECTING state and close the socket
+    for (int i = 0; i < config.workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    // Transition to DISCONNECTING state and close the sockets
     handle_transition(DISCONNECTING);
-    close(sockfd);
+    for (int i = 0; i < config.workers; i++) {
+        close(workers[i].sockfd);
+        session_table_free(&workers[i].shard.sessions);
+        free(workers[i].shard.pending_sacks);
+        free(workers[i].shard.inflate_buffer);
+        for (int j = 0; j < workers[i].handler_count; j++) {
+            Handler *handler = &workers[i].handlers[j];
+            pthread_join(handler->thread, NULL);
+            session_table_free(&handler->shard.sessions);
+            free(handler->shard.pending_sacks);
+            free(handler->shard.inflate_buffer);
+            ring_free(&handler->inbound);
+            ring_free(&handler->outbound);
+            close(handler->wake_fd);
+        }
+        free(workers[i].handlers);
+        pool_free(&workers[i].pool);
+        if (workers[i].use_uring) {
+            uring_buf_ring_close(&workers[i].ring, &workers[i].recv_bufs);
+            uring_close(&workers[i].ring);
+        } else {
+            close(workers[i].epollfd);
+        }
+        close(workers[i].idle_timerfd);
+        close(workers[i].completion_fd);
+    }
+    free(workers);
+    if (verify) {
+        verifier_stop(&verifier);
+    }
+    if (dedup) {
+        chunk_store_close(&chunk_store);
+    }
+    stripe_table_free(&stripe_table);
     handle_transition(DISCONNECTED);
     return 0;
 }
 
+// Function to look up an open transfer of this session, or NULL if the client does not own the ID
+static FileTransfer *find_transfer(Session *session, uint32_t file_id) {
+    FileTransfer *transfer = session_find_transfer(session, file_id);
+    if (transfer == NULL || transfer->closing) {
+        return NULL;
+    }
+    return transfer;
+}
+
+// Function to find the transfer a repeated request asks for: one of the session's transfers of the
+// same name and byte range that no segment or manifest part has reached yet. The client repeats a
+// request whose response was lost, and that must not open a second transfer.
+static FileTransfer *find_requested_transfer(Session *session, const char *filename, uint64_t stripe_offset, uint64_t length) {
+    for (int i = 0; i < session->transfer_count; i++) {
+        FileTransfer *transfer = session->transfers[i];
+        if (!transfer->started && !transfer->closing && transfer->name != NULL && strcmp(transfer->name, filename) == 0 &&
+            transfer->stripe_offset == stripe_offset && transfer->file_size == length) {
+            return transfer;
+        }
+    }
+    return NULL;
+}
+
+// Function to check whether a segment has already been written
+static int transfer_has_segment(const FileTransfer *transfer, uint32_t segment_number) {
+    return (transfer->received_map[segment_number / 64] >> (segment_number % 64)) & 1;
+}
+
+// Function to record a written segment and advance the in-order count past it
+static void transfer_mark_segment(FileTransfer *transfer, uint32_t segment_number) {
+    transfer->received_map[segment_number / 64] |= (uint64_t)1 << (segment_number % 64);
+    transfer->received_count++;
+    if (segment_number >= transfer->highest_segment) {
+        transfer->highest_segment = segment_number + 1;
+    }
+    while (transfer->received_segments < transfer->highest_segment &&
+           transfer_has_segment(transfer, transfer->received_segments)) {
+        transfer->received_segments++;
+    }
+}
+
+// Function to record every segment lying wholly inside the file range start..end-1, which was
+// filled in without being received. The client skips exactly these segments.
+static void transfer_mark_range(FileTransfer *transfer, uint64_t start, uint64_t end) {
+    uint32_t first = (start + transfer->segment_size - 1) / transfer->segment_size;
+    uint32_t last = end == transfer->file_size ? transfer->total_segments : end / transfer->segment_size;
+    for (uint32_t segment = first; segment < last; segment++) {
+        if (!transfer_has_segment(transfer, segment)) {
+            transfer_mark_segment(transfer, segment);
+        }
+    }
+}
+
+// Function to collect up to CP_MAX_SACK_RANGES runs of segments received beyond the in-order ones
+static int transfer_sack_ranges(const FileTransfer *transfer, CP_SackRange *ranges) {
+    int count = 0;
+    uint32_t segment = transfer->received_segments;
+    while (count < CP_MAX_SACK_RANGES && segment < transfer->highest_segment) {
+        while (segment < transfer->highest_segment && !transfer_has_segment(transfer, segment)) {
+            segment++;
+        }
+        if (segment == transfer->highest_segment) {
+            break;
+        }
+        ranges[count].start = segment;
+        while (segment < transfer->highest_segment && transfer_has_segment(transfer, segment)) {
+            segment++;
+        }
+        ranges[count].end = segment;
+        count++;
+    }
+    return count;
+}
+
+// Function to send a transfer's selective acknowledgment now
+static void transfer_send_sack(Shard *shard, Session *session, FileTransfer *transfer) {
+    CP_FileSegmentSack sack;
+    CP_SackRange ranges[CP_MAX_SACK_RANGES];
+    int range_count = transfer_sack_ranges(transfer, ranges);
+    size_t size = encode_file_segment_sack(&sack, transfer->file_id, transfer->received_segments, ranges, range_count);
+    session_reply(shard, session, &sack, size);
+    transfer->unacked_segments = 0;
+}
+
+// Function to note that a transfer owes a SACK, so all segments dispatched from one batch share it
+static void shard_queue_sack(Shard *shard, Session *session, FileTransfer *transfer) {
+    if (transfer->sack_queued) {
+        return;
+    }
+    if (shard->pending_sack_count == shard->pending_sack_capacity) {
+        int capacity = shard->pending_sack_capacity ? shard->pending_sack_capacity * 2 : 16;
+        PendingSack *pending = realloc(shard->pending_sacks, capacity * sizeof(*pending));
+        if (pending == NULL) {
+            transfer_send_sack(shard, session, transfer);
+            return;
+        }
+        shard->pending_sacks = pending;
+        shard->pending_sack_capacity = capacity;
+    }
+    shard->pending_sacks[shard->pending_sack_count].addr = session->addr;
+    shard->pending_sacks[shard->pending_sack_count].file_id = transfer->file_id;
+    shard->pending_sack_count++;
+    transfer->sack_queued = 1;
+}
+
+// Function to send the SACKs owed by transfers that received segments during the last batch
+static void shard_flush_sacks(Shard *shard) {
+    for (int i = 0; i < shard->pending_sack_count; i++) {
+        Session *session = session_lookup(&shard->sessions, &shard->pending_sacks[i].addr);
+        FileTransfer *transfer = session ? find_transfer(session, shard->pending_sacks[i].file_id) : NULL;
+        if (transfer == NULL) {
+            continue;
+        }
+        transfer->sack_queued = 0;
+        if (transfer->unacked_segments > 0) {
+            transfer_send_sack(shard, session, transfer);
+        }
+    }
+    shard->pending_sack_count = 0;
+}
+
+// Function to turn down a file transfer request so the client fails fast instead of waiting
+static void reject_file_transfer(Shard *shard, Session *session, uint8_t status, uint32_t request_id) {
+    CP_FileTransferResponse response;
+    encode_file_transfer_response(&response, 0, 0, status, 0, 0, request_id, 0);
+    session_reply(shard, session, &response, sizeof(response));
+    handle_transition(ERROR);
+}
+
+// Function to open the data file of an upload other than a later stripe under a fresh file ID,
+// stored in *file_id and named in path. The interrupted upload's data file resume_from is taken
+// over when given, and *resumed tells whether it was; otherwise a new file is created. IDs whose
+// data file already exists, such as one left by an earlier run, are skipped, never overwritten.
+// Returns NULL with errno set if no file could be opened.
+static FILE *open_data_file(Shard *shard, const char *filename, const char *resume_from, char *path, size_t path_size, uint32_t *file_id, int *resumed) {
+    *resumed = 0;
+    for (int attempt = 0; attempt < DATA_FILE_ATTEMPTS; attempt++) {
+        *file_id = shard_next_file_id(shard);
+        snprintf(path, path_size, "%u_%s", *file_id, filename);
+        if (resume_from != NULL) {
+            if (renameat2(AT_FDCWD, resume_from, AT_FDCWD, path, RENAME_NOREPLACE) == 0) {
+                *resumed = 1;
+                return fopen(path, "r+b");
+            }
+            if (errno == EEXIST) {
+                continue;
+            }
+            LOG_WARN("Cannot resume %s from %s: %s", filename, resume_from, strerror(errno));
+            resume_from = NULL;
+        }
+        int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0666);
+        if (fd >= 0) {
+            FILE *file = fdopen(fd, "w+b");
+            if (file == NULL) {
+                int saved_errno = errno;
+                close(fd);
+                unlink(path);
+                errno = saved_errno;
+            }
+            return file;
+        }
+        if (errno != EEXIST) {
+            return NULL;
+        }
+    }
+    errno = EEXIST;
+    return NULL;
+}
+
+// Function to reserve the whole file on disk so segments land in one contiguous extent, and hint
+// the kernel that it will be written front to back. Returns -1 only if the volume is out of space.
+static int preallocate_file(FILE *file, uint64_t file_size) {
+    int fd = fileno(file);
+    if (file_size > 0 && fallocate(fd, 0, 0, file_size) < 0) {
+        if (errno == ENOSPC || errno == EFBIG) {
+            return -1;
+        }
+        // Filesystems without fallocate still work, they just grow the file as segments arrive
+        LOG_DEBUG("Preallocation unsupported: %s", strerror(errno));
+    }
+    posix_fadvise(fd, 0, file_size, POSIX_FADV_SEQUENTIAL);
+    return 0;
+}
+
 // Function to handle a file transfer request
-void handle_file_transfer_request(int sockfd, struct sockaddr_in *cliaddr, socklen_t len, CP_FileTransferRequest *request) {
-    static uint32_t current_file_id = 1; // ID for the current file transfer
-    char filename[MAX_FILENAME_LENGTH];
-    uint64_t file_size;
+void handle_file_transfer_request(Shard *shard, Session *session, const CP_FileTransferRequestView *request) {
+    const char *filename = request->filename;
+    uint64_t file_size = request->file_size;
+
+    // A stripe carries one byte range of the file and is tracked like a transfer of its own, so
+    // the stripes of one upload can be handled by different workers. The first stripe creates
+    // the file; the others write into it. Stripes are neither resumed nor deduplicated.
+    int striped = (request->flags & CP_TRANSFER_STRIPE) != 0;
+    uint32_t stripe_of = striped ? request->stripe_of : 0;
+    uint64_t length = file_size;
+    if (striped) {
+        if (request->stripe_offset > file_size || request->stripe_length > file_size - request->stripe_offset) {
+            LOG_WARN("Invalid stripe of %s: %" PRIu64 " bytes at %" PRIu64 " of %" PRIu64, filename, request->stripe_length, request->stripe_offset, file_size);
+            reject_file_transfer(shard, session, CP_TRANSFER_REJECTED, request->request_id);
+            return;
+        }
+        length = request->stripe_length;
+    }
 
-    // Decode the file transfer request
-    decode_file_transfer_request(request, filename, &file_size);
+    // A later stripe may only write into the file of an open first stripe that the same client
+    // requested for the same file. Its socket, and so its session, differs from the first one's.
+    if (stripe_of != 0 && !stripe_table_match(shard->worker->stripe_table, stripe_of, session->addr.sin_addr, filename, file_size)) {
+        LOG_WARN("Stripe of %s refers to file ID %u, which is not an open upload of it from this client", filename, stripe_of);
+        reject_file_transfer(shard, session, CP_TRANSFER_REJECTED, request->request_id);
+        return;
+    }
 
-    // Check if the maximum number of file transfers has been reached
-    if (current_file_id >= MAX_FILE_ID) {
-        printf("Maximum number of file transfers reached\n");
-        handle_transition(ERROR);
+    // Answer a repeated request the way the first one was answered
+    FileTransfer *requested = find_requested_transfer(session, filename, striped ? request->stripe_offset : 0, length);
+    if (requested != NULL) {
+        CP_FileTransferResponse response;
+        encode_file_transfer_response(&response, requested->file_id, requested->segment_size, CP_TRANSFER_ACCEPTED, requested->received_segments, requested->granted, request->request_id, requested->upload_token);
+        session_reply(shard, session, &response, sizeof(response));
+        if (requested->highest_segment > requested->received_segments) {
+            transfer_send_sack(shard, session, requested);
+        }
+        LOG_DEBUG("Repeated request for %s answered with file ID %u", filename, requested->file_id);
+        return;
+    }
+
+    // Grant the requested segment size up to what the packet buffers hold
+    uint16_t segment_size = request->segment_size ? request->segment_size : FILE_SEGMENT_SIZE;
+    if (segment_size > shard->worker->max_segment_size) {
+        segment_size = shard->worker->max_segment_size;
+    }
+
+    // A resumed upload is found by the token it was given, and keeps the segment size of its
+    // checkpoint, since the bitmap is laid out by it. A checkpoint of that token that cannot be
+    // resumed from is removed along with its data file; the client sends the file from the start.
+    char checkpoint_path[MAX_FILENAME_LENGTH + 32];
+    TransferCheckpoint checkpoint;
+    uint64_t *resume_map = NULL;
+    uint64_t upload_token = 0;
+    if ((request->flags & CP_TRANSFER_RESUME) && !striped && request->upload_token != 0) {
+        snprintf(checkpoint_path, sizeof(checkpoint_path), "%s.%016" PRIx64 ".ckpt", filename, request->upload_token);
+        resume_map = checkpoint_load(checkpoint_path, file_size, request->upload_token, shard->worker->max_segment_size, &checkpoint);
+        if (resume_map != NULL) {
+            segment_size = checkpoint.segment_size;
+            upload_token = request->upload_token;
+        } else {
+            checkpoint_discard(checkpoint_path, filename, request->upload_token);
+        }
+    }
+
+    // Any other upload but a stripe gets a random token of its own to be resumed by. Without
+    // one it is simply not checkpointed.
+    if (!striped && upload_token == 0) {
+        if (getrandom(&upload_token, sizeof(upload_token), 0) != sizeof(upload_token)) {
+            perror("Failed to generate upload token");
+            upload_token = 0;
+        }
+        snprintf(checkpoint_path, sizeof(checkpoint_path), "%s.%016" PRIx64 ".ckpt", filename, upload_token);
+    }
+
+    // One bit per segment; the segment count must fit the 32-bit segment numbers
+    uint64_t total_segments = (length + segment_size - 1) / segment_size;
+    if (total_segments > UINT32_MAX) {
+        LOG_WARN("File too large for transfer: %s (%" PRIu64 " bytes)", filename, file_size);
+        reject_file_transfer(shard, session, CP_TRANSFER_REJECTED, request->request_id);
         return;
     }
 
-    // Initialize the file transfer structure
-    FileTransfer *transfer = &file_transfers[current_file_id];
-    transfer->file_id = current_file_id;
-    transfer->file_size = file_size;
-    transfer->received_segments = 0;
+    // Refuse up front what the volume cannot hold rather than failing halfway through. A resumed
+    // upload already holds its space, and so does a stripe added to an upload.
+    struct statvfs volume;
+    if (resume_map == NULL && stripe_of == 0 && statvfs(".", &volume) == 0 && (uint64_t)volume.f_bavail * volume.f_frsize < file_size) {
+        LOG_WARN("Not enough space for %s: %" PRIu64 " bytes requested, %" PRIu64 " available", filename, file_size, (uint64_t)volume.f_bavail * volume.f_frsize);
+        reject_file_transfer(shard, session, CP_TRANSFER_NO_SPACE, request->request_id);
+        return;
+    }
 
-    // Create the full filename for the file transfer
-    char full_filename[MAX_FILENAME_LENGTH + 10];
-    snprintf(full_filename, sizeof(full_filename), "%u_%s", current_file_id, filename);
+    // Initialize the file transfer structure; its file ID is assigned with the data file
+    FileTransfer *transfer = calloc(1, sizeof(*transfer));
+    if (transfer == NULL) {
+        perror("Failed to allocate file transfer");
+        reject_file_transfer(shard, session, CP_TRANSFER_REJECTED, request->request_id);
+        free(resume_map);
+        return;
+    }
+    transfer->file_size = length;
+    transfer->stripe_offset = striped ? request->stripe_offset : 0;
+    transfer->segment_size = segment_size;
+    transfer->total_segments = (uint32_t)total_segments;
+    transfer->last_activity = now_seconds();
+    transfer->last_checkpoint = transfer->last_activity;
+    transfer->upload_token = upload_token;
+    transfer->checkpoint_path = upload_token != 0 ? strdup(checkpoint_path) : NULL;
+    transfer->received_map = calloc((total_segments + 63) / 64 + 1, sizeof(uint64_t));
+    if ((upload_token != 0 && transfer->checkpoint_path == NULL) || transfer->received_map == NULL) {
+        perror("Failed to allocate segment bitmap");
+        reject_file_transfer(shard, session, CP_TRANSFER_REJECTED, request->request_id);
+        free(transfer->received_map);
+        free(transfer->checkpoint_path);
+        free(transfer);
+        free(resume_map);
+        return;
+    }
 
-    // Open the file for writing
-    transfer->file = fopen(full_filename, "wb");
+    // Open the file for writing (and reading back its chunks). Later stripes write into the first
+    // stripe's file; anything else takes over the interrupted upload's data file under a new file ID
+    // and replays its bitmap, or creates a new one. If the takeover fails the upload starts over
+    // and the interrupted upload is discarded. The interrupted transfer may still be open and keeps
+    // writing into the data file it took over, but no longer checkpoints it.
+    char full_filename[MAX_FILENAME_LENGTH + 16];
+    int resumed = 0;
+    if (stripe_of != 0) {
+        transfer->file_id = shard_next_file_id(shard);
+        snprintf(full_filename, sizeof(full_filename), "%u_%s", stripe_of, filename);
+        transfer->file = fopen(full_filename, "r+b");
+    } else {
+        char resume_filename[MAX_FILENAME_LENGTH + 16];
+        if (resume_map != NULL) {
+            snprintf(resume_filename, sizeof(resume_filename), "%u_%s", checkpoint.file_id, filename);
+        }
+        transfer->file = open_data_file(shard, filename, resume_map != NULL ? resume_filename : NULL, full_filename, sizeof(full_filename), &transfer->file_id, &resumed);
+        if (resume_map != NULL && !resumed) {
+            checkpoint_discard(checkpoint_path, filename, upload_token);
+        }
+        if (transfer->file != NULL && resumed) {
+            transfer->checkpoint_file_id = checkpoint.file_id;
+            for (uint32_t segment = 0; segment < transfer->total_segments; segment++) {
+                if ((resume_map[segment / 64] >> (segment % 64)) & 1) {
+                    transfer_mark_segment(transfer, segment);
+                }
+            }
+            transfer->checkpointed_count = transfer->received_count;
+        }
+    }
+    free(resume_map);
     if (transfer->file == NULL) {
         perror("Failed to open file for writing");
-        handle_transition(ERROR);
+        reject_file_transfer(shard, session, CP_TRANSFER_REJECTED, request->request_id);
+        free(transfer->checkpoint_path);
+        free(transfer->received_map);
+        free(transfer);
+        return;
+    }
+    if (stripe_of == 0 && preallocate_file(transfer->file, file_size) < 0) {
+        LOG_WARN("Not enough space for %s: %" PRIu64 " bytes requested", filename, file_size);
+        reject_file_transfer(shard, session, CP_TRANSFER_NO_SPACE, request->request_id);
+        fclose(transfer->file);
+        unlink(full_filename);
+        free(transfer->checkpoint_path);
+        free(transfer->received_map);
+        free(transfer);
         return;
     }
 
-    printf("File transfer initiated: %s (ID: %u, Size: %" PRIu64 " bytes)\n", filename, current_file_id, file_size);
+    // The transfer belongs to the requesting client's session; a first stripe is also listed
+    // so the upload's later stripes can join it
+    if (session_add_transfer(session, transfer) < 0 ||
+        (striped && stripe_of == 0 && stripe_table_add(shard->worker->stripe_table, transfer->file_id, session->addr.sin_addr, filename, file_size) < 0)) {
+        perror("Failed to track file transfer");
+        if (transfer->session != NULL) {
+            session_remove_transfer(session, transfer);
+        }
+        reject_file_transfer(shard, session, CP_TRANSFER_REJECTED, request->request_id);
+        fclose(transfer->file);
+        if (stripe_of == 0) {
+            unlink(full_filename);
+        }
+        free(transfer->checkpoint_path);
+        free(transfer->received_map);
+        free(transfer);
+        return;
+    }
+    if (striped && stripe_of == 0) {
+        transfer->stripe_table = shard->worker->stripe_table;
+    }
+
+    // Deduplicate against the chunk store when the client offers a manifest. The resume flag tells
+    // the client whether its interrupted upload was picked up or is starting over.
+    uint8_t granted = resumed ? CP_TRANSFER_RESUME : 0;
+    if (striped) {
+        granted |= CP_TRANSFER_STRIPE;
+    } else if ((request->flags & CP_TRANSFER_DEDUP) && shard->worker->chunk_store != NULL) {
+        transfer->chunk_store = shard->worker->chunk_store;
+        granted |= CP_TRANSFER_DEDUP;
+    }
+
+    // Tell the client which file ID and segment size to use for its segments, and where to resume
+    transfer->name = strdup(filename);
+    transfer->granted = granted;
+    CP_FileTransferResponse response;
+    encode_file_transfer_response(&response, transfer->file_id, segment_size, CP_TRANSFER_ACCEPTED, transfer->received_segments, granted, request->request_id, transfer->upload_token);
+    session_reply(shard, session, &response, sizeof(response));
+
+    if (resumed) {
+        LOG_INFO("File transfer resumed: %s (ID: %u, %u of %u segments of %u bytes already received)", filename, transfer->file_id, transfer->received_count, transfer->total_segments, segment_size);
+        // Point the checkpoint at the renamed data file, and report what was received past the gap
+        transfer_checkpoint(transfer);
+        if (transfer->highest_segment > transfer->received_segments) {
+            transfer_send_sack(shard, session, transfer);
+        }
+    } else if (striped) {
+        LOG_INFO("File stripe initiated: %s (ID: %u, bytes %" PRIu64 " to %" PRIu64 " of %" PRIu64 " in file ID %u, segments of %u bytes)", filename, transfer->file_id, transfer->stripe_offset, transfer->stripe_offset + length, file_size, stripe_of != 0 ? stripe_of : transfer->file_id, segment_size);
+    } else {
+        LOG_INFO("File transfer initiated: %s (ID: %u, Size: %" PRIu64 " bytes, segments of %u bytes)", filename, transfer->file_id, file_size, segment_size);
+    }
 
-    current_file_id++;
 }
 
 // Function to handle a file segment
-void handle_file_segment(int sockfd, struct sockaddr_in *cliaddr, socklen_t len, CP_FileSegment *segment) {
-    uint32_t file_id, segment_number;
-    uint16_t segment_size;
-    char segment_data[FILE_SEGMENT_SIZE];
-
-    // Decode the file segment
-    decode_file_segment(segment, &file_id, &segment_number, segment_data, &segment_size);
+void handle_file_segment(Shard *shard, Session *session, const CP_FileSegmentView *segment) {
+    uint32_t file_id = segment->file_id;
+    uint32_t segment_number = segment->segment_number;
 
     // Check if the file ID is valid
-    if (file_id >= MAX_FILE_ID || file_transfers[file_id].file == NULL) {
-        printf("Invalid file ID: %u\n", file_id);
+    FileTransfer *transfer = find_transfer(session, file_id);
+    if (transfer == NULL) {
+        LOG_WARN("Invalid file ID: %u", file_id);
         handle_transition(ERROR);
         return;
     }
 
-    // Write the file segment to the file
-    FileTransfer *transfer = &file_transfers[file_id];
-    fwrite(segment_data, 1, segment_size, transfer->file);
-    transfer->received_segments++;
+    transfer->last_activity = now_seconds();
+    transfer->started = 1;
+
+    // Every segment but the last carries the negotiated size, so its number fixes its offset
+    // and, for compressed data, the size it must expand to
+    uint64_t offset = (uint64_t)segment_number * transfer->segment_size;
+    uint16_t size = transfer->file_size - offset < transfer->segment_size ? transfer->file_size - offset : transfer->segment_size;
+    if (segment_number >= transfer->total_segments || (segment->codec == CP_CODEC_NONE && segment->segment_size != size)) {
+        LOG_WARN("Invalid segment %u of file ID %u (%u bytes)", segment_number, file_id, segment->segment_size);
+        return;
+    }
+
+    // A duplicate means the sender missed an acknowledgment; answer it at once without rewriting
+    if (transfer_has_segment(transfer, segment_number)) {
+        LOG_DEBUG("Duplicate segment %u of file ID %u", segment_number, file_id);
+        transfer_send_sack(shard, session, transfer);
+        return;
+    }
+
+    // Persist progress every checkpoint_interval seconds; the idle sweep catches uploads that stall
+    // in between. Segments are only marked once their write has completed, and the file is synced
+    // first, so the checkpoint never claims one that is not on disk yet.
+    int interval = shard->worker->checkpoint_interval;
+    if (interval > 0 && transfer->received_count != transfer->checkpointed_count &&
+        transfer->last_activity - transfer->last_checkpoint >= interval) {
+        transfer_checkpoint(transfer);
+    }
+
+    // Expand compressed data into the shard's buffer; raw data is written from the receive buffer
+    const char *data = segment->data;
+    if (segment->codec != CP_CODEC_NONE) {
+        if (shard->inflate_buffer == NULL && (shard->inflate_buffer = malloc(shard->worker->max_segment_size)) == NULL) {
+            perror("Failed to allocate decompression buffer");
+            return;
+        }
+        if (codec_decompress(segment->codec, segment->data, segment->segment_size, shard->inflate_buffer, size) != size) {
+            LOG_WARN("Undecodable %s-compressed segment %u of file ID %u", codec_name(segment->codec), segment_number, file_id);
+            return;
+        }
+        data = shard->inflate_buffer;
+    }
 
-    printf("Received segment %u of file ID %u\n", segment_number, file_id);
+    // Drop a segment damaged on the way, or in decompression, before it reaches the file; the
+    // sender resends it like a lost one
+    if (crc32c(0, data, size) != segment->crc32c) {
+        LOG_WARN("CRC mismatch in segment %u of file ID %u, dropped", segment_number, file_id);
+        return;
+    }
 
-    // Send an acknowledgment for the received segment
-    CP_FileSegmentAck ack;
-    encode_file_segment_ack(&ack, file_id, segment_number);
-    sendto(sockfd, &ack, sizeof(ack), MSG_CONFIRM, (const struct sockaddr *)cliaddr, len);
+    // Only the receive thread owns the io_uring; a queued write marks the segment on completion
+    if (shard->handler == NULL && shard->worker->use_uring) {
+        int queued = worker_uring_write(shard->worker, transfer, segment_number, data, size, transfer->stripe_offset + offset);
+        if (queued != 0) {
+            return;
+        }
+    } else if (pwrite(fileno(transfer->file), data, size, transfer->stripe_offset + offset) != size) {
+        perror("Failed to write file segment");
+        handle_transition(ERROR);
+        return;
+    }
+    transfer_segment_written(shard, session, transfer, segment_number);
 }
 
-// Function to handle a file segment acknowledgment
-void handle_file_segment_ack(int sockfd, struct sockaddr_in *cliaddr, socklen_t len, CP_FileSegmentAck *ack) {
-    uint32_t file_id, segment_number;
+// Function to mark a segment once its data is in the file and acknowledge it. A segment that
+// arrived twice while its first write was in flight is only counted once.
+static void transfer_segment_written(Shard *shard, Session *session, FileTransfer *transfer, uint32_t segment_number) {
+    if (transfer_has_segment(transfer, segment_number)) {
+        return;
+    }
+    int in_order = segment_number == transfer->received_segments;
+    transfer_mark_segment(transfer, segment_number);
+
+    LOG_DEBUG("Received segment %u of file ID %u", segment_number, transfer->file_id);
+
+    int complete = transfer->received_count == transfer->total_segments;
+    if (complete) {
+        LOG_DEBUG("All %u segments of file ID %u received", transfer->total_segments, transfer->file_id);
+    }
+
+    // Nobody is waiting on a transfer that is already being closed
+    if (transfer->closing || session == NULL) {
+        return;
+    }
 
-    // Decode the file segment acknowledgment
-    decode_file_segment_ack(ack, &file_id, &segment_number);
+    // A segment past a gap is reported at once so the sender can fill the gap early. Otherwise
+    // acknowledge once per received batch, every ack_every segments, or when the file is complete.
+    if (!in_order || ++transfer->unacked_segments >= (uint32_t)shard->worker->ack_every || complete) {
+        transfer_send_sack(shard, session, transfer);
+    } else {
+        shard_queue_sack(shard, session, transfer);
+    }
+}
 
-    printf("Acknowledgment received for segment %u of file ID %u\n", segment_number, file_id);
+// Function to handle a file segment acknowledgment
+void handle_file_segment_ack(Shard *shard, Session *session, const CP_FileSegmentAckView *ack) {
+    (void)shard;
+    (void)session;
+    LOG_DEBUG("Acknowledgment received for segment %u of file ID %u", ack->segment_number, ack->file_id);
 }
 
 // Function to handle the completion of a file transfer
-void handle_file_transfer_complete(int sockfd, struct sockaddr_in *cliaddr, socklen_t len, CP_FileTransferComplete *complete) {
-    uint32_t file_id;
-
-    // Decode the file transfer completion message
-    decode_file_transfer_complete(complete, &file_id);
+void handle_file_transfer_complete(Shard *shard, Session *session, const CP_FileTransferCompleteView *complete) {
+    uint32_t file_id = complete->file_id;
 
     // Check if the file ID is valid
-    if (file_id >= MAX_FILE_ID || file_transfers[file_id].file == NULL) {
-        printf("Invalid file ID: %u\n", file_id);
+    FileTransfer *transfer = find_transfer(session, file_id);
+    if (transfer == NULL) {
+        LOG_WARN("Invalid file ID: %u", file_id);
         handle_transition(ERROR);
         return;
     }
 
+    if (transfer->received_count < transfer->total_segments) {
+        LOG_WARN("File transfer incomplete: ID %u (%u of %u segments)", file_id, transfer->received_count, transfer->total_segments);
+    } else if (complete->has_hash && shard->worker->verifier != NULL) {
+        // Checked once the file is closed, which with io_uring waits for the last writes
+        transfer->verifier = shard->worker->verifier;
+        transfer->file_hash = complete->file_hash;
+    }
+
     // Close the file and mark the transfer as complete
-    FileTransfer *transfer = &file_transfers[file_id];
-    fclose(transfer->file);
-    transfer->file = NULL;
+    transfer_close(transfer);
+
+    LOG_INFO("File transfer complete: ID %u", file_id);
+}
+
+// Function to handle part of a chunk manifest: copy the chunks the store already holds into the
+// file, mark the segments they cover as received and tell the client which chunks those were.
+// Runs of stored chunks are counted per manifest part, the same way the client counts them.
+void handle_chunk_manifest(Shard *shard, Session *session, const CP_ChunkManifestView *manifest) {
+    uint32_t file_id = manifest->file_id;
+
+    // Check if the file ID is valid
+    FileTransfer *transfer = find_transfer(session, file_id);
+    if (transfer == NULL) {
+        LOG_WARN("Invalid file ID: %u", file_id);
+        handle_transition(ERROR);
+        return;
+    }
+    transfer->last_activity = now_seconds();
+    transfer->started = 1;
+    if (transfer->chunk_store == NULL) {
+        LOG_WARN("Chunk manifest for file ID %u, which is not deduplicated", file_id);
+        return;
+    }
+
+    // Every chunk but the last is at least CHUNK_MIN_SIZE bytes, which bounds the count
+    if (manifest->total_chunks > transfer->file_size / CHUNK_MIN_SIZE + 1 ||
+        manifest->first_chunk > manifest->total_chunks || manifest->chunk_count > manifest->total_chunks - manifest->first_chunk ||
+        (transfer->chunks != NULL && manifest->total_chunks != transfer->chunk_count)) {
+        LOG_WARN("Invalid chunk manifest for file ID %u", file_id);
+        return;
+    }
+    if (transfer->chunks == NULL) {
+        transfer->chunks = calloc(manifest->total_chunks, sizeof(*transfer->chunks));
+        if (transfer->chunks == NULL) {
+            perror("Failed to allocate chunk manifest");
+            return;
+        }
+        transfer->chunk_count = manifest->total_chunks;
+    }
+
+    uint8_t known[CP_MAX_MANIFEST_CHUNKS / 8] = {0};
+    uint64_t offset = manifest->offset;
+    uint64_t run_start = offset;
+    int in_run = 0;
+    for (uint16_t i = 0; i < manifest->chunk_count; i++) {
+        CP_ChunkEntry entry;
+        view_chunk_entry(manifest, i, &entry);
+        if (entry.length == 0 || entry.length > CHUNK_MAX_SIZE || offset + entry.length > transfer->file_size) {
+            LOG_WARN("Invalid chunk %u in manifest for file ID %u", manifest->first_chunk + i, file_id);
+            break;
+        }
+        TransferChunk *chunk = &transfer->chunks[manifest->first_chunk + i];
+        memcpy(chunk->hash, entry.hash, sizeof(chunk->hash));
+        chunk->offset = offset;
+        chunk->length = entry.length;
+
+        // A part sent again is answered the same way without copying its chunks twice
+        if (!chunk->known && chunk_store_contains(transfer->chunk_store, entry.hash, entry.length)) {
+            chunk->known = chunk_store_read(transfer->chunk_store, entry.hash, entry.length, fileno(transfer->file), offset) == 0;
+        }
+        if (chunk->known) {
+            known[i / 8] |= 1 << (i % 8);
+            if (!in_run) {
+                run_start = offset;
+                in_run = 1;
+            }
+        } else if (in_run) {
+            transfer_mark_range(transfer, run_start, offset);
+            in_run = 0;
+        }
+        offset += entry.length;
+    }
+    if (in_run) {
+        transfer_mark_range(transfer, run_start, offset);
+    }
+
+    LOG_DEBUG("Chunk manifest for file ID %u: chunks %u to %u", file_id, manifest->first_chunk, manifest->first_chunk + manifest->chunk_count - 1);
 
-    printf("File transfer complete: ID %u\n", file_id);
+    CP_ChunkManifestAck ack;
+    size_t size = encode_chunk_manifest_ack(&ack, file_id, manifest->first_chunk, known, manifest->chunk_count);
+    session_reply(shard, session, &ack, size);
 }
@@ -0,0 +1,183 @@
+#include "session.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Initial number of slots; the table never shrinks below this
+#define SESSION_TABLE_MIN_CAPACITY 64
+
+// Function to hash a peer address and port into 32 bits
+uint32_t session_hash(const struct sockaddr_in *addr) {
+    uint32_t h = addr->sin_addr.s_addr ^ ((uint32_t)addr->sin_port << 16 | addr->sin_port);
+    h ^= h >> 16;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35;
+    h ^= h >> 16;
+    return h;
+}
+
+// Function to compare two peer addresses
+static int session_key_equal(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+// Function to allocate an empty slot array of the given power-of-two capacity
+static int session_table_alloc(SessionTable *table, uint32_t capacity) {
+    Session **slots = calloc(capacity, sizeof(*slots));
+    if (slots == NULL) {
+        return -1;
+    }
+    table->slots = slots;
+    table->capacity = capacity;
+    return 0;
+}
+
+// Function to move every session into a table of a new capacity
+static void session_table_resize(SessionTable *table, uint32_t capacity) {
+    Session **old_slots = table->slots;
+    uint32_t old_capacity = table->capacity;
+    if (session_table_alloc(table, capacity) < 0) {
+        return; // Keep the current table; it still works, just with longer probes
+    }
+
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i] != NULL) {
+            uint32_t slot = session_hash(&old_slots[i]->addr) & (capacity - 1);
+            while (table->slots[slot] != NULL) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            table->slots[slot] = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+void session_table_init(SessionTable *table) {
+    table->count = 0;
+    if (session_table_alloc(table, SESSION_TABLE_MIN_CAPACITY) < 0) {
+        table->capacity = 0;
+    }
+}
+
+void session_table_free(SessionTable *table) {
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i] != NULL) {
+            free(table->slots[i]->transfers);
+            free(table->slots[i]);
+        }
+    }
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+// Function to find the session for a peer address, or NULL if the client is unknown
+Session *session_lookup(SessionTable *table, const struct sockaddr_in *addr) {
+    if (table->capacity == 0) {
+        return NULL;
+    }
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t slot = session_hash(addr) & mask; table->slots[slot] != NULL; slot = (slot + 1) & mask) {
+        if (session_key_equal(&table->slots[slot]->addr, addr)) {
+            return table->slots[slot];
+        }
+    }
+    return NULL;
+}
+
+// Function to create a session for a peer address that is not in the table yet
+Session *session_create(SessionTable *table, const struct sockaddr_in *addr, time_t now) {
+    // Keep the load factor below 3/4 so probe sequences stay short
+    if (table->capacity == 0 || (table->count + 1) * 4 > table->capacity * 3) {
+        session_table_resize(table, table->capacity ? table->capacity * 2 : SESSION_TABLE_MIN_CAPACITY);
+        if (table->capacity == 0 || table->count + 1 >= table->capacity) {
+            return NULL;
+        }
+    }
+
+    Session *session = calloc(1, sizeof(*session));
+    if (session == NULL) {
+        return NULL;
+    }
+    session->addr = *addr;
+    session->last_activity = now;
+
+    uint32_t mask = table->capacity - 1;
+    uint32_t slot = session_hash(addr) & mask;
+    while (table->slots[slot] != NULL) {
+        slot = (slot + 1) & mask;
+    }
+    table->slots[slot] = session;
+    table->count++;
+    return session;
+}
+
+// Function to remove and free a session. Uses backward-shift deletion so no tombstones are needed.
+void session_remove(SessionTable *table, Session *session) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t slot = session_hash(&session->addr) & mask;
+    while (table->slots[slot] != session) {
+        if (table->slots[slot] == NULL) {
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    // Pull later members of the probe cluster back into the hole when their home slot allows it
+    uint32_t hole = slot;
+    for (uint32_t next = (hole + 1) & mask; table->slots[next] != NULL; next = (next + 1) & mask) {
+        uint32_t home = session_hash(&table->slots[next]->addr) & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            table->slots[hole] = table->slots[next];
+            hole = next;
+        }
+    }
+    table->slots[hole] = NULL;
+    table->count--;
+
+    free(session->transfers);
+    free(session);
+
+    // Give memory back once most sessions are gone
+    if (table->capacity > SESSION_TABLE_MIN_CAPACITY && table->count * 8 < table->capacity) {
+        session_table_resize(table, table->capacity / 2);
+    }
+}
+
+// Function to attach a transfer to the session that requested it
+int session_add_transfer(Session *session, FileTransfer *transfer) {
+    if (session->transfer_count == session->transfer_capacity) {
+        int capacity = session->transfer_capacity ? session->transfer_capacity * 2 : 4;
+        FileTransfer **transfers = realloc(session->transfers, capacity * sizeof(*transfers));
+        if (transfers == NULL) {
+            return -1;
+        }
+        session->transfers = transfers;
+        session->transfer_capacity = capacity;
+    }
+    session->transfers[session->transfer_count++] = transfer;
+    transfer->session = session;
+    return 0;
+}
+
+// Function to find one of the session's transfers by file ID
+FileTransfer *session_find_transfer(Session *session, uint32_t file_id) {
+    for (int i = 0; i < session->transfer_count; i++) {
+        if (session->transfers[i]->file_id == file_id) {
+            return session->transfers[i];
+        }
+    }
+    return NULL;
+}
+
+// Function to detach a transfer from its session (the caller frees it)
+void session_remove_transfer(Session *session, FileTransfer *transfer) {
+    for (int i = 0; i < session->transfer_count; i++) {
+        if (session->transfers[i] == transfer) {
+            session->transfers[i] = session->transfers[--session->transfer_count];
+            transfer->session = NULL;
+            return;
+        }
+    }
+}
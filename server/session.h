@@ -0,0 +1,87 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+#include "chunk_store.h"
+#include "verify.h"
+#include "stripe_table.h"
+
+typedef struct Session Session;
+
+// Chunk of an upload, as announced in the client's manifest
+typedef struct {
+    uint8_t hash[CP_CHUNK_HASH_SIZE];
+    uint64_t offset;
+    uint32_t length; // 0 until announced
+    int known; // Filled in from the chunk store instead of being received
+} TransferChunk;
+
+// Structure to handle file transfer details
+typedef struct {
+    uint32_t file_id; // ID of the file being transferred
+    FILE *file; // Pointer to the file being transferred
+    char *name; // File name the client requested, so a repeated request finds this transfer
+    uint8_t granted; // CP_TRANSFER_* flags granted in the response
+    int started; // A segment or manifest part has arrived; a request of the same name is a new upload
+    uint64_t file_size; // Bytes this transfer carries: the whole file, or one stripe of it
+    uint64_t stripe_offset; // File offset of segment 0, non-zero for the later stripes of an upload
+    StripeTable *stripe_table; // Lists this first stripe while it is open; NULL for other transfers
+    uint16_t segment_size; // Negotiated payload of every segment but the last
+    uint32_t total_segments; // Segments needed to cover file_size
+    uint64_t *received_map; // Bitmap of the segments written so far
+    uint32_t received_count; // Distinct segments written
+    uint32_t received_segments; // Number of segments received in order, i.e. the first missing one
+    uint32_t highest_segment; // One past the highest segment received
+    uint32_t unacked_segments; // Segments received since the last selective acknowledgment
+    int sack_queued; // Listed in the shard's pending acknowledgments
+    time_t last_activity; // Monotonic time of the last datagram for this transfer
+    uint64_t upload_token; // Random name of the upload, given to the client for resuming it (0 for stripes)
+    char *checkpoint_path; // Where the received bitmap is persisted for resuming the upload (NULL for stripes)
+    time_t last_checkpoint; // Monotonic time the bitmap was last persisted
+    uint32_t checkpointed_count; // received_count when the bitmap was last persisted
+    uint32_t checkpoint_file_id; // File ID the checkpoint on disk must name for this transfer to replace it
+    ChunkStore *chunk_store; // Store the upload is deduplicated against, or NULL
+    TransferChunk *chunks; // Chunks from the manifest, allocated by its first part
+    uint32_t chunk_count;
+    Verifier *verifier; // Checks the file against file_hash once closed; NULL when not to be verified
+    uint64_t file_hash; // XXH64 of the transferred range sent with the completion message
+    uint32_t writes_inflight; // Asynchronous writes not yet completed (io_uring backend)
+    int closing; // Close the file once writes_inflight drops to zero
+    Session *session; // Session that owns this transfer
+} FileTransfer;
+
+// Per-client state, keyed by the client's address and port
+struct Session {
+    struct sockaddr_in addr; // Peer address used as the session key
+    time_t last_activity; // Monotonic time of the last datagram from this client
+    uint64_t packets_received;
+    uint64_t bytes_received;
+    uint64_t packets_sent;
+    FileTransfer **transfers; // Active transfers owned by this client
+    int transfer_count;
+    int transfer_capacity;
+};
+
+// Open-addressing hash table (linear probing) of live sessions.
+// Memory grows and shrinks with the number of sessions.
+typedef struct {
+    Session **slots; // NULL marks an empty slot
+    uint32_t capacity; // Power of two
+    uint32_t count;
+} SessionTable;
+
+uint32_t session_hash(const struct sockaddr_in *addr);
+void session_table_init(SessionTable *table);
+void session_table_free(SessionTable *table);
+Session *session_lookup(SessionTable *table, const struct sockaddr_in *addr);
+Session *session_create(SessionTable *table, const struct sockaddr_in *addr, time_t now);
+void session_remove(SessionTable *table, Session *session);
+
+int session_add_transfer(Session *session, FileTransfer *transfer);
+FileTransfer *session_find_transfer(Session *session, uint32_t file_id);
+void session_remove_transfer(Session *session, FileTransfer *transfer);
+
+#endif // SESSION_H
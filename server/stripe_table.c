@@ -0,0 +1,72 @@
+#include "stripe_table.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Function to set up an empty table
+int stripe_table_init(StripeTable *table) {
+    table->head = NULL;
+    return pthread_mutex_init(&table->lock, NULL) != 0 ? -1 : 0;
+}
+
+// Function to release every entry still listed
+void stripe_table_free(StripeTable *table) {
+    while (table->head != NULL) {
+        StripeOwner *owner = table->head;
+        table->head = owner->next;
+        free(owner->name);
+        free(owner);
+    }
+    pthread_mutex_destroy(&table->lock);
+}
+
+// Function to list a newly opened first stripe
+int stripe_table_add(StripeTable *table, uint32_t file_id, struct in_addr client, const char *name, uint64_t file_size) {
+    StripeOwner *owner = malloc(sizeof(*owner));
+    if (owner == NULL) {
+        return -1;
+    }
+    owner->name = strdup(name);
+    if (owner->name == NULL) {
+        free(owner);
+        return -1;
+    }
+    owner->file_id = file_id;
+    owner->client = client;
+    owner->file_size = file_size;
+
+    pthread_mutex_lock(&table->lock);
+    owner->next = table->head;
+    table->head = owner;
+    pthread_mutex_unlock(&table->lock);
+    return 0;
+}
+
+// Function to drop a first stripe that is being closed
+void stripe_table_remove(StripeTable *table, uint32_t file_id) {
+    pthread_mutex_lock(&table->lock);
+    for (StripeOwner **link = &table->head; *link != NULL; link = &(*link)->next) {
+        StripeOwner *owner = *link;
+        if (owner->file_id == file_id) {
+            *link = owner->next;
+            free(owner->name);
+            free(owner);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&table->lock);
+}
+
+// Function to check that file_id is an open first stripe of the same client, file name and size.
+// Returns 1 if a later stripe may join it.
+int stripe_table_match(StripeTable *table, uint32_t file_id, struct in_addr client, const char *name, uint64_t file_size) {
+    int match = 0;
+    pthread_mutex_lock(&table->lock);
+    for (StripeOwner *owner = table->head; owner != NULL; owner = owner->next) {
+        if (owner->file_id == file_id) {
+            match = owner->client.s_addr == client.s_addr && owner->file_size == file_size && strcmp(owner->name, name) == 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&table->lock);
+    return match;
+}
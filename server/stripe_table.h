@@ -0,0 +1,31 @@
+#ifndef STRIPE_TABLE_H
+#define STRIPE_TABLE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+// Open first stripe of a striped upload, which the later stripes of that upload write beside
+typedef struct StripeOwner {
+    uint32_t file_id; // File ID of the first stripe; the data file is "<file_id>_<name>"
+    struct in_addr client; // Address the first stripe was requested from (any source port)
+    char *name;
+    uint64_t file_size; // Size of the whole file, not of the stripe
+    struct StripeOwner *next;
+} StripeOwner;
+
+// Table shared by every worker of the first stripes still open. The stripes of one upload arrive
+// from different sockets and usually land on different workers, so a stripe naming an upload
+// by its first file ID is checked here rather than against its own session.
+typedef struct {
+    pthread_mutex_t lock; // Protects the list
+    StripeOwner *head;
+} StripeTable;
+
+int stripe_table_init(StripeTable *table);
+void stripe_table_free(StripeTable *table);
+int stripe_table_add(StripeTable *table, uint32_t file_id, struct in_addr client, const char *name, uint64_t file_size);
+void stripe_table_remove(StripeTable *table, uint32_t file_id);
+int stripe_table_match(StripeTable *table, uint32_t file_id, struct in_addr client, const char *name, uint64_t file_size);
+
+#endif // STRIPE_TABLE_H
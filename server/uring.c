@@ -0,0 +1,212 @@
+#include "uring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// Thin wrappers around the io_uring system calls
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Function to create a ring with the given number of submission entries and map its queues
+int uring_init(Uring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = sys_io_uring_setup(entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_len > ring->sq_len) {
+            ring->sq_len = ring->cq_len;
+        }
+        ring->cq_len = ring->sq_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_len);
+            close(ring->fd);
+            return -1;
+        }
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        uring_close(ring);
+        return -1;
+    }
+
+    char *sq = ring->sq_ptr;
+    char *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+// Function to unmap the queues and close the ring
+void uring_close(Uring *ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+    if (ring->sq_ptr != NULL) {
+        munmap(ring->sq_ptr, ring->sq_len);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+// Function to reserve the next submission entry, or NULL if the queue is full.
+// The entry is zeroed; it becomes visible to the kernel on the next submit.
+struct io_uring_sqe *uring_get_sqe(Uring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+    unsigned index = ring->sqe_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+// Function to publish prepared entries and enter the kernel, waiting for at least wait_nr completions.
+// Returns the number of entries consumed or -errno.
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr) {
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && wait_nr == 0) {
+        return 0;
+    }
+
+    int ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    return ret < 0 ? -errno : ret;
+}
+
+// Function to return the oldest unconsumed completion, or NULL if none is ready
+struct io_uring_cqe *uring_peek_cqe(Uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+// Function to hand the completion returned by uring_peek_cqe back to the kernel
+void uring_cqe_seen(Uring *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// Function to allocate entries buffers of buf_size bytes and register them as buffer group bgid
+int uring_buf_ring_init(Uring *ring, UringBufRing *bufs, uint16_t bgid, unsigned entries, size_t buf_size) {
+    memset(bufs, 0, sizeof(*bufs));
+    if (entries == 0 || (entries & (entries - 1)) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t ring_len = entries * sizeof(struct io_uring_buf);
+    bufs->br = mmap(NULL, ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs->br == MAP_FAILED) {
+        bufs->br = NULL;
+        return -1;
+    }
+    bufs->base = malloc(entries * buf_size);
+    if (bufs->base == NULL) {
+        munmap(bufs->br, ring_len);
+        bufs->br = NULL;
+        return -1;
+    }
+    bufs->buf_size = buf_size;
+    bufs->entries = entries;
+    bufs->bgid = bgid;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)bufs->br;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        free(bufs->base);
+        munmap(bufs->br, ring_len);
+        bufs->br = NULL;
+        bufs->base = NULL;
+        return -1;
+    }
+
+    // Hand every buffer to the kernel
+    bufs->br->tail = 0;
+    for (unsigned i = 0; i < entries; i++) {
+        uring_buf_ring_recycle(bufs, (uint16_t)i);
+    }
+    return 0;
+}
+
+// Function to unregister the buffer group and free its storage
+void uring_buf_ring_close(Uring *ring, UringBufRing *bufs) {
+    if (bufs->br == NULL) {
+        return;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = bufs->bgid;
+    sys_io_uring_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(bufs->br, bufs->entries * sizeof(struct io_uring_buf));
+    free(bufs->base);
+    memset(bufs, 0, sizeof(*bufs));
+}
+
+// Function to return the storage of buffer bid
+char *uring_buf_ring_get(UringBufRing *bufs, uint16_t bid) {
+    return bufs->base + (size_t)bid * bufs->buf_size;
+}
+
+// Function to give buffer bid back to the kernel once its contents have been consumed
+void uring_buf_ring_recycle(UringBufRing *bufs, uint16_t bid) {
+    uint16_t tail = bufs->br->tail;
+    struct io_uring_buf *buf = &bufs->br->bufs[tail & (bufs->entries - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buf_ring_get(bufs, bid);
+    buf->len = (uint32_t)bufs->buf_size;
+    buf->bid = bid;
+    __atomic_store_n(&bufs->br->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
@@ -0,0 +1,53 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// Minimal io_uring wrapper built directly on the system calls (no liburing dependency)
+typedef struct {
+    int fd;
+    // Submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries;
+    unsigned sqe_tail; // Tail including SQEs prepared but not yet published
+    // Completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    // Mappings to release on close
+    void *sq_ptr;
+    size_t sq_len;
+    void *cq_ptr;
+    size_t cq_len;
+    size_t sqes_len;
+} Uring;
+
+// Ring of kernel-selected receive buffers registered with IORING_REGISTER_PBUF_RING
+typedef struct {
+    struct io_uring_buf_ring *br;
+    char *base; // Backing storage for all buffers
+    size_t buf_size;
+    unsigned entries; // Power of two
+    uint16_t bgid; // Buffer group ID used in IOSQE_BUFFER_SELECT
+} UringBufRing;
+
+int uring_init(Uring *ring, unsigned entries);
+void uring_close(Uring *ring);
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr);
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+void uring_cqe_seen(Uring *ring);
+
+int uring_buf_ring_init(Uring *ring, UringBufRing *bufs, uint16_t bgid, unsigned entries, size_t buf_size);
+void uring_buf_ring_close(Uring *ring, UringBufRing *bufs);
+char *uring_buf_ring_get(UringBufRing *bufs, uint16_t bid);
+void uring_buf_ring_recycle(UringBufRing *bufs, uint16_t bid);
+
+#endif // URING_H
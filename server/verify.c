@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include "verify.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "log.h"
+#include "xxh64.h"
+
+// Bytes read back per pread while hashing an upload
+#define VERIFY_BLOCK_SIZE (1024 * 1024)
+
+// Function to hash a job's byte range; returns -1 if the file could not be read in full
+static int verify_hash_range(const VerifyJob *job, char *block, uint64_t *hash) {
+    Xxh64 ctx;
+    xxh64_init(&ctx, 0);
+    posix_fadvise(job->fd, job->offset, job->length, POSIX_FADV_SEQUENTIAL);
+    uint64_t done = 0;
+    while (done < job->length) {
+        size_t want = job->length - done < VERIFY_BLOCK_SIZE ? job->length - done : VERIFY_BLOCK_SIZE;
+        ssize_t n = pread(job->fd, block, want, job->offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        xxh64_update(&ctx, block, n);
+        done += n;
+    }
+    *hash = xxh64_final(&ctx);
+    return 0;
+}
+
+// Function to check a completed upload against the hash the client computed while sending it
+static void verify_job(Verifier *verifier, const VerifyJob *job, char *block) {
+    uint64_t hash;
+    if (verify_hash_range(job, block, &hash) < 0) {
+        LOG_ERROR("Failed to read back file ID %u for verification: %s", job->file_id, errno ? strerror(errno) : "short file");
+        verifier->mismatched++;
+    } else if (hash != job->expected) {
+        LOG_ERROR("File ID %u is corrupt: XXH64 %016" PRIx64 " of %" PRIu64 " bytes, client sent %016" PRIx64, job->file_id, hash, job->length, job->expected);
+        verifier->mismatched++;
+    } else {
+        LOG_INFO("File ID %u verified (XXH64 %016" PRIx64 ", %" PRIu64 " bytes)", job->file_id, hash, job->length);
+        verifier->verified++;
+    }
+}
+
+// Function run by the verifier thread: take jobs off the queue until stopped and drained
+static void *verifier_main(void *arg) {
+    Verifier *verifier = arg;
+    char *block = malloc(VERIFY_BLOCK_SIZE);
+    if (block == NULL) {
+        perror("Failed to allocate verification buffer");
+    }
+    pthread_mutex_lock(&verifier->lock);
+    for (;;) {
+        while (verifier->head == NULL && !verifier->stopping) {
+            pthread_cond_wait(&verifier->wake, &verifier->lock);
+        }
+        VerifyJob *job = verifier->head;
+        if (job == NULL) {
+            break;
+        }
+        verifier->head = job->next;
+        if (verifier->head == NULL) {
+            verifier->tail = NULL;
+        }
+        pthread_mutex_unlock(&verifier->lock);
+
+        errno = 0;
+        if (block != NULL) {
+            verify_job(verifier, job, block);
+        }
+        close(job->fd);
+        free(job);
+
+        pthread_mutex_lock(&verifier->lock);
+    }
+    pthread_mutex_unlock(&verifier->lock);
+    free(block);
+    return NULL;
+}
+
+// Function to start the verifier thread
+int verifier_start(Verifier *verifier) {
+    memset(verifier, 0, sizeof(*verifier));
+    if (pthread_mutex_init(&verifier->lock, NULL) != 0) {
+        return -1;
+    }
+    if (pthread_cond_init(&verifier->wake, NULL) != 0) {
+        pthread_mutex_destroy(&verifier->lock);
+        return -1;
+    }
+    if (pthread_create(&verifier->thread, NULL, verifier_main, verifier) != 0) {
+        pthread_cond_destroy(&verifier->wake);
+        pthread_mutex_destroy(&verifier->lock);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to check the uploads still queued and stop the thread
+void verifier_stop(Verifier *verifier) {
+    pthread_mutex_lock(&verifier->lock);
+    verifier->stopping = 1;
+    pthread_cond_signal(&verifier->wake);
+    pthread_mutex_unlock(&verifier->lock);
+    pthread_join(verifier->thread, NULL);
+    if (verifier->verified + verifier->mismatched > 0) {
+        LOG_INFO("Verifier: %" PRIu64 " uploads verified, %" PRIu64 " corrupt or unreadable", verifier->verified, verifier->mismatched);
+    }
+    pthread_cond_destroy(&verifier->wake);
+    pthread_mutex_destroy(&verifier->lock);
+}
+
+// Function to queue the length bytes at offset of the open file fd for verification. The
+// descriptor is duplicated, so the caller may close its own right away.
+int verifier_submit(Verifier *verifier, int fd, uint64_t offset, uint64_t length, uint64_t expected, uint32_t file_id) {
+    VerifyJob *job = malloc(sizeof(*job));
+    if (job == NULL) {
+        return -1;
+    }
+    job->fd = dup(fd);
+    if (job->fd < 0) {
+        free(job);
+        return -1;
+    }
+    job->offset = offset;
+    job->length = length;
+    job->expected = expected;
+    job->file_id = file_id;
+    job->next = NULL;
+
+    pthread_mutex_lock(&verifier->lock);
+    if (verifier->tail != NULL) {
+        verifier->tail->next = job;
+    } else {
+        verifier->head = job;
+    }
+    verifier->tail = job;
+    pthread_cond_signal(&verifier->wake);
+    pthread_mutex_unlock(&verifier->lock);
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+// Completed upload waiting to be read back and checked against the client's hash
+typedef struct VerifyJob {
+    int fd; // Duplicate of the transfer's descriptor, closed once checked
+    uint64_t offset; // Byte range of the file the hash covers (one stripe, or all of it)
+    uint64_t length;
+    uint64_t expected; // XXH64 sent in the completion message
+    uint32_t file_id;
+    struct VerifyJob *next;
+} VerifyJob;
+
+// Background thread shared by every worker that hashes completed uploads, so reading a whole
+// file back never stalls a receive thread. Jobs are checked in the order they were queued.
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock; // Protects the queue and stopping
+    pthread_cond_t wake;
+    VerifyJob *head;
+    VerifyJob *tail;
+    int stopping; // Finish the queued jobs, then exit
+    uint64_t verified; // Uploads whose hash matched, only touched by the thread
+    uint64_t mismatched;
+} Verifier;
+
+int verifier_start(Verifier *verifier);
+void verifier_stop(Verifier *verifier);
+int verifier_submit(Verifier *verifier, int fd, uint64_t offset, uint64_t length, uint64_t expected, uint32_t file_id);
+
+#endif // VERIFY_H